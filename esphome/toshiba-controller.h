@@ -3,8 +3,11 @@
  * @brief Toshiba AC controller component for ESPHome
  *
  */
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cmath>
-#include <queue>
+#include <type_traits>
 
 #include "esphome.h"
 #include "esphome/components/climate/climate.h"
@@ -14,16 +17,72 @@
 #include "esphome/components/uart/uart.h"
 #include "esphome/core/component.h"
 
+#ifdef USE_ESP32
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#endif
+
 static const char* const TAG = "toshiba-controller";
 
 #define MIN_TEMP_SETPOINT_HEATING 5
 #define MIN_TEMP_SETPOINT_COOLING 17
 #define MAX_TEMP_SETPOINT 30
 
+// run the smart thermostat law in centi-degree integers instead of double, opt in for targets without an FPU via
+// build_flags. it is not bit-identical to the double law: both agree where the inputs are exact in binary and
+// decimal (e.g. quarter degrees with an integer multiplier), elsewhere 0.01 °C ties may round the other way
+#ifndef TOSHIBA_THERMOSTAT_FIXED_POINT
+#define TOSHIBA_THERMOSTAT_FIXED_POINT 0
+#endif
+
+// order matches ToshibaController::get_sensors()
+enum ToshibaSensor {
+    SENSOR_OUTDOOR_TEMPERATURE,
+    SENSOR_FCU_AIR_TEMP,
+    SENSOR_FCU_SETPOINT,
+    SENSOR_FCU_TC_TEMP,
+    SENSOR_FCU_TCJ_TEMP,
+    SENSOR_FCU_FAN_RPM,
+    SENSOR_CDU_TD_TEMP,
+    SENSOR_CDU_TS_TEMP,
+    SENSOR_CDU_TE_TEMP,
+    SENSOR_CDU_LOAD,
+    SENSOR_CDU_IAC,
+    SENSOR_FILTERED_COUNT,
+};
+
+// a new value is only published if it moved by more than both deadbands and the minimum interval
+// since the last publish has elapsed. a due publish heartbeat overrides both, a heartbeat of 0 never does.
+struct SensorFilterSettings {
+    float absolute_deadband = 0;
+    float relative_deadband = 0;  // fraction of the last published value
+    uint32_t min_interval_seconds = 0;
+};
+
 struct ConfigSettings {
     double smart_thermostat_multiplier = 4.0;
     bool smart_thermostat_runaway_protection = false;
     bool disable_cooling_modes = false;
+    // unchanged registers and sensors are republished at most this often. 0 publishes registers and unfiltered
+    // sensors on every update, the sensor filters still apply
+    uint32_t publish_heartbeat_seconds = 300;
+    // send the next frame as soon as the IDU answered the previous one instead of after a fixed gap
+    bool ack_paced_tx = false;
+    // ESP32 only: assemble RX frames in a dedicated task instead of loop()
+    bool uart_rx_task = false;
+    // evaluate the smart thermostat when one of its inputs changed instead of on a fixed 30 s tick
+    bool smart_thermostat_event_driven = false;
+    // event driven evaluations are spaced by at least this much, every evaluation may move the setpoint by a step
+    uint32_t smart_thermostat_min_interval_seconds = 30;
+    // replace the multiplier law with a PID controller, the gains below apply until auto-tuning stored its own.
+    // editing them or pressing the reset button discards the tuned gains
+    bool smart_thermostat_pid = false;
+    float pid_kp = 4.0f;
+    float pid_ki = 0.002f;  // per second
+    float pid_kd = 0.0f;    // seconds
+    // hold the setpoint back when the room model learned online predicts an overshoot of the target
+    bool smart_thermostat_predictive = false;
+    SensorFilterSettings sensor_filters[SENSOR_FILTERED_COUNT];
 };
 
 namespace esphome {
@@ -48,6 +107,37 @@ public:
     }
 };
 
+// Sensor that only forwards a value to HA when it changed beyond its deadband or the heartbeat interval elapsed.
+class ShadowedSensor final : public sensor::Sensor {
+    float last_value_ = NAN;
+    uint32_t last_publish_millis_ = 0;
+    SensorFilterSettings filter_;
+
+public:
+    void set_filter_settings(const SensorFilterSettings& filter) {
+        filter_ = filter;
+    }
+
+    void publish_if_changed(float value, uint32_t now, uint32_t heartbeat_millis) {
+        uint32_t since_publish = now - last_publish_millis_;
+        bool heartbeat_due = heartbeat_millis != 0 && since_publish >= heartbeat_millis;
+        if (!std::isnan(last_value_) && !heartbeat_due) {
+            if (since_publish < filter_.min_interval_seconds * 1000) {
+                return;
+            }
+            float deadband = std::max(filter_.absolute_deadband, filter_.relative_deadband * std::fabs(last_value_));
+            // without a heartbeat, sensors without a deadband publish every update like the registers do
+            bool suppress_unchanged = heartbeat_millis != 0 || deadband > 0;
+            if (suppress_unchanged && std::fabs(value - last_value_) <= deadband) {
+                return;
+            }
+        }
+        last_value_ = value;
+        last_publish_millis_ = now;
+        publish_state(value);
+    }
+};
+
 const std::string CUSTOM_FAN_MODE_LOW_MEDIUM = "Low Medium";
 const std::string CUSTOM_FAN_MODE_MEDIUM_HIGH = "Medium High";
 
@@ -126,6 +216,30 @@ enum ToshibaIonizer { IONIZER_ON = 0x18, IONIZER_OFF = 0x10 };
 
 enum ToshibaSelfCleaning { SELF_CLEANING_ON = 0x18, SELF_CLEANING_OFF = 0x10 };
 
+enum HandshakeState {
+    HANDSHAKE_BOOT,
+    HANDSHAKE_SENT,
+    HANDSHAKE_POST_SENT,
+    HANDSHAKE_DONE,
+};
+
+static const uint32_t SNAPSHOT_MIN_SAVE_INTERVAL = 15 * 60 * 1000;
+
+// the offset history is sampled on a fixed tick in both thermostat modes. event driven evaluations are spaced
+// by at least smart_thermostat_min_interval_seconds, the fallback interval covers inputs that are not observed.
+static const uint32_t THERMOSTAT_SAMPLE_INTERVAL = 30000;
+static const uint32_t THERMOSTAT_FALLBACK_INTERVAL = 300000;
+
+// the handshake advances as soon as the IDU replied and our frames are on the wire. an IDU that powers up with
+// the ESP can take well over 10 s to answer, so the handshake is repeated with backoff until it does
+static const uint32_t HANDSHAKE_BOOT_DELAY = 200;
+static const uint32_t HANDSHAKE_REPLY_TIMEOUT = 3000;
+static const uint32_t HANDSHAKE_MAX_RETRY_INTERVAL = 30000;
+
+// a write is resent if its echo does not arrive within the timeout, doubling it on every attempt
+static const uint32_t WRITE_CONFIRM_TIMEOUT = 1000;
+static const uint8_t WRITE_MAX_ATTEMPTS = 3;
+
 static const std::vector<std::vector<uint8_t>> IDU_HANDSHAKE = {
     {0x02, 0xFF, 0xFF, 0x00, 0x00, 0x00, 0x00, 0x02},
     {0x02, 0xFF, 0xFF, 0x01, 0x00, 0x00, 0x01, 0x02, 0xFE},
@@ -140,542 +254,2191 @@ static const std::vector<std::vector<uint8_t>> IDU_POST_HANDSHAKE = {
     //behaviour
     {0x02, 0x00, 0x02, 0x02, 0x00, 0x00, 0x02, 0x00, 0x00, 0xFA}};
 
-class ToshibaController final : public climate::Climate, public Component {
-    climate::ClimateTraits supported_traits_;
-
-    esphome::uart::UARTComponent* serial_;
-    esphome::sensor::Sensor* temperature_sensor_;
-    esphome::template_::TemplateSelect* swing_mode_select_;
-    esphome::template_::TemplateSelect* special_mode_select_;
-    esphome::template_::TemplateSelect* power_selection_select_;
+static const uint8_t RX_FRAME_START = 0x02;
+// the largest frame the IDU sends is a 24 byte status response
+static const uint8_t RX_FRAME_MAX_LEN = 30;
+
+// the largest frame we ever send is a register write (13 byte header, value, checksum)
+static const uint8_t TX_FRAME_MAX_LEN = 15;
+// per priority class: a full register refresh queues 12 frames, the handshake 6
+static const uint8_t TX_QUEUE_CAPACITY = 16;
+// fixed inter-frame gap, also the lower bound of the ack timeout
+static const uint32_t TX_FRAME_GAP = 100;
+// ack pacing: bus idle time after a response before the next frame goes out, and the margin added to
+// twice the learned turnaround time to get the ack timeout
+static const uint32_t TX_ACK_GUARD = 10;
+static const uint32_t TX_ACK_MARGIN = 20;
+static const uint32_t TX_ACK_MAX_TIMEOUT = 300;
+// a queued class is served after this many frames of higher classes went out ahead of it
+static const uint8_t TX_STARVATION_LIMIT = 8;
+
+// TX priority classes, lower values are sent first
+enum TxPriority : uint8_t {
+    TX_PRIORITY_USER,      // control from HA, selects and switches
+    TX_PRIORITY_PROTOCOL,  // handshake, follow-up reads and writes issued by the controller itself
+    TX_PRIORITY_POLLING,   // background register polling
+    TX_PRIORITY_COUNT,
+};
 
-    uint32_t last_partial_register_request_millis_ = 0;
-    uint32_t last_full_register_request_millis_ = 0;
-    uint32_t last_external_temperature_sensor_control_millis_ = 0;
+enum TxFrameKind : uint8_t {
+    TX_FRAME_RAW,
+    TX_FRAME_READ,
+    TX_FRAME_WRITE,
+};
 
-    CustomSwitch switch_internal_thermistor_;
-    CustomSwitch switch_ionizer_;
+// register requests share a 12 byte header, followed by the command, the value for writes and the checksum
+using ReadFrame = std::array<uint8_t, 14>;
+using WriteFrame = std::array<uint8_t, 15>;
+static constexpr uint8_t READ_FRAME_HEADER[12] = {0x2, 0x0, 0x3, 0x10, 0x0, 0x0, 0x6, 0x1, 0x30, 0x1, 0x0, 0x1};
+static constexpr uint8_t WRITE_FRAME_HEADER[12] = {0x2, 0x0, 0x3, 0x10, 0x0, 0x0, 0x7, 0x1, 0x30, 0x1, 0x0, 0x2};
+
+// checksum sum of the header, the start byte is not included
+template <size_t N>
+constexpr uint8_t frame_header_sum(const uint8_t (&header)[N]) {
+    uint8_t sum = 0;
+    for (size_t i = 1; i < N; i++) {
+        sum += header[i];
+    }
+    return sum;
+}
+static constexpr uint8_t READ_FRAME_HEADER_SUM = frame_header_sum(READ_FRAME_HEADER);
+static constexpr uint8_t WRITE_FRAME_HEADER_SUM = frame_header_sum(WRITE_FRAME_HEADER);
+
+template <typename Frame, size_t N>
+constexpr Frame frame_with_header(const uint8_t (&header)[N]) {
+    Frame frame{};
+    for (size_t i = 0; i < N; i++) {
+        frame[i] = header[i];
+    }
+    return frame;
+}
 
-    uint8_t recv_buf_[256] = {};
-    uint32_t recv_buf_len_ = 0;
-    uint32_t last_recv_millis_ = 0;
+constexpr ReadFrame make_read_frame(uint8_t command) {
+    ReadFrame frame = frame_with_header<ReadFrame>(READ_FRAME_HEADER);
+    frame[12] = command;
+    frame[13] = -(READ_FRAME_HEADER_SUM + command);
+    return frame;
+}
 
-    std::vector<std::vector<uint8_t>> send_msg_queue_;
-    uint32_t last_sent_millis_ = 0;
+constexpr uint8_t write_frame_checksum(uint8_t command, uint8_t value) {
+    return -(WRITE_FRAME_HEADER_SUM + command + value);
+}
 
-    ConfigSettings config_settings_;
+constexpr WriteFrame make_write_frame(uint8_t command, uint8_t value) {
+    WriteFrame frame = frame_with_header<WriteFrame>(WRITE_FRAME_HEADER);
+    frame[12] = command;
+    frame[13] = value;
+    frame[14] = write_frame_checksum(command, value);
+    return frame;
+}
 
-    ToshibaState internal_power_state_ = ToshibaState::STATE_OFF;
-    ToshibaFanMode internal_fan_mode_ = ToshibaFanMode::FAN_MEDIUM;
-    ToshibaSwingMode internal_swing_mode_ = ToshibaSwingMode::SWING_MODE_OFF;
-    ToshibaSpecialModes internal_special_mode_ = ToshibaSpecialModes::SPECIAL_MODE_STANDARD;
-    ToshibaPowerSelection internal_power_selection_ = ToshibaPowerSelection::POWER_100;
-    uint8_t internal_target_temperature_ = 20;
+static_assert(make_read_frame(0x80)[13] == 0x34, "read frame checksum");
+static_assert(make_write_frame(0xC7, 0x18)[14] == 0xD3, "write frame checksum");
 
-    bool is_initialized_ = false;
+struct TxFrame {
+    uint8_t data[TX_FRAME_MAX_LEN];
+    uint8_t len;
+    TxFrameKind kind;
+    uint8_t command;  // register command of read and write frames
+};
 
-    int8_t internal_idu_room_temperature_ = 0;
+// RX state shared between the RX task and loop() is atomic on ESP32, plain everywhere else
+#ifdef USE_ESP32
+template <typename T>
+using RxShared = std::atomic<T>;
 
-    sensor::Sensor sensor_outdoor_temperature_;
-    sensor::Sensor sensor_cdu_td_temp_;
-    sensor::Sensor sensor_cdu_ts_temp_;
-    sensor::Sensor sensor_cdu_te_temp_;
-    sensor::Sensor sensor_cdu_load_;
-    sensor::Sensor sensor_cdu_iac_;
-    sensor::Sensor sensor_fcu_air_temp_;
-    sensor::Sensor sensor_fcu_setpoint_temp_;
-    sensor::Sensor sensor_fcu_tc_temp_;
-    sensor::Sensor sensor_fcu_tcj_temp_;
-    sensor::Sensor sensor_fcu_fan_rpm_;
+static const uint8_t RX_TASK_QUEUE_LEN = 8;
+static const uint32_t RX_TASK_STACK_SIZE = 4096;
+static const UBaseType_t RX_TASK_PRIORITY = 5;  // above the loop task, it sleeps a tick between polls
 
-    uint64_t loop_cnt_ = 0;
+// single producer (RX task), single consumer (loop()) ring of complete frames
+template <uint8_t N>
+class RxFrameQueue {
+public:
+    struct Entry {
+        uint8_t data[RX_FRAME_MAX_LEN];
+        uint8_t len;
+        uint32_t recv_millis;
+    };
+
+    bool push(const uint8_t* data, uint8_t len, uint32_t recv_millis) {
+        uint8_t head = head_.load(std::memory_order_relaxed);
+        uint8_t next = (head + 1) % N;
+        if (next == tail_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        Entry& entry = entries_[head];
+        memcpy(entry.data, data, len);
+        entry.len = len;
+        entry.recv_millis = recv_millis;
+        head_.store(next, std::memory_order_release);
+        return true;
+    }
 
-    uint8_t calc_checksum(uint8_t* data, uint8_t length) {
-        uint8_t sum = 0;
-        for (size_t i = 1; i < length; i++) {
-            sum += data[i];
+    // oldest frame or nullptr, stays valid until pop()
+    const Entry* front() const {
+        uint8_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == head_.load(std::memory_order_acquire)) {
+            return nullptr;
         }
-        return (-sum) & 0xFF;
+        return &entries_[tail];
     }
 
-    void process_uart_tx() {
-        if (millis() - last_sent_millis_ < 100) {
-            return;
-        }
+    void pop() {
+        tail_.store((tail_.load(std::memory_order_relaxed) + 1) % N, std::memory_order_release);
+    }
 
-        if (recv_buf_len_ > 0 || millis() - last_recv_millis_ < 100) {
-            return;
+private:
+    Entry entries_[N];
+    std::atomic<uint8_t> head_{0};
+    std::atomic<uint8_t> tail_{0};
+};
+#else
+template <typename T>
+using RxShared = T;
+#endif
+
+// power of two millisecond buckets: <1, <2, <4 ... <128, >=128
+class LatencyHistogram {
+public:
+    static const uint8_t BUCKETS = 9;
+
+    void add(uint32_t millis) {
+        uint8_t bucket = 0;
+        while (bucket < BUCKETS - 1 && millis >= (1u << bucket)) {
+            bucket++;
         }
+        counts_[bucket]++;
+        max_ = std::max(max_, millis);
+    }
 
-        if (send_msg_queue_.size() == 0) {
-            return;
+    void log(const char* name) const {
+        ESP_LOGD(TAG, "[STATS] %s ms: <1:%d <2:%d <4:%d <8:%d <16:%d <32:%d <64:%d <128:%d >=128:%d max:%d", name,
+                 counts_[0], counts_[1], counts_[2], counts_[3], counts_[4], counts_[5], counts_[6], counts_[7],
+                 counts_[8], max_);
+    }
+
+private:
+    uint32_t counts_[BUCKETS] = {};
+    uint32_t max_ = 0;
+};
+
+// Fixed capacity window of timestamped samples with O(1) mean and median. Samples are kept in arrival order in a
+// ring for expiry and in a sorted array for the median. Insert and evict are a binary search plus a memmove, which
+// at this size beats a skiplist or two heaps and needs no allocation.
+template <typename T, uint8_t N>
+class RollingMedianWindow {
+    using Sum = typename std::conditional<std::is_floating_point<T>::value, T, int32_t>::type;
+
+    T values_[N];
+    uint32_t times_[N];
+    T sorted_[N];
+    uint8_t head_ = 0;
+    uint8_t size_ = 0;
+    Sum sum_ = 0;
+
+    void evict_oldest_() {
+        T value = values_[head_];
+        T* pos = std::lower_bound(sorted_, sorted_ + size_, value);
+        memmove(pos, pos + 1, (sorted_ + size_ - pos - 1) * sizeof(T));
+        sum_ -= value;
+        head_ = (head_ + 1) % N;
+        size_--;
+    }
+
+public:
+    // drops the oldest sample when full
+    void push(T value, uint32_t time) {
+        if (size_ == N) {
+            evict_oldest_();
+        }
+        uint8_t tail = (head_ + size_) % N;
+        values_[tail] = value;
+        times_[tail] = time;
+        T* pos = std::upper_bound(sorted_, sorted_ + size_, value);
+        memmove(pos + 1, pos, (sorted_ + size_ - pos) * sizeof(T));
+        *pos = value;
+        sum_ += value;
+        size_++;
+    }
+
+    // removes samples older than max_age as long as more than min_samples are left
+    void expire(uint32_t now, uint32_t max_age, uint8_t min_samples) {
+        while (size_ > min_samples && now - times_[head_] > max_age) {
+            evict_oldest_();
         }
+    }
 
-        ESP_LOGD(TAG, "sending: %s", format_hex_pretty(send_msg_queue_.front()).c_str());
-        last_sent_millis_ = millis();
-        serial_->write_array(send_msg_queue_.front());
-        send_msg_queue_.erase(send_msg_queue_.begin());
-        ESP_LOGD(TAG, "finished sending");
+    bool empty() const {
+        return size_ == 0;
     }
 
-    void handle_register_mode(ToshibaMode value) {
-        if (this->internal_power_state_ == ToshibaState::STATE_OFF) {
-            ESP_LOGE(TAG, "[REGISTER] received mode %s, but IDU is powered off",
-                     format_hex_pretty((uint8_t)value).c_str());
-            this->mode = climate::CLIMATE_MODE_OFF;
-            this->publish_state();
-            return;
+    uint8_t size() const {
+        return size_;
+    }
+
+    // mean of the two middle samples for even sizes
+    T median() const {
+        uint8_t n = size_ / 2;
+        return size_ % 2 == 0 ? (sorted_[n - 1] + sorted_[n]) / 2 : sorted_[n];
+    }
+
+    T mean() const {
+        return sum_ / size_;
+    }
+};
+
+// arithmetic of the smart thermostat law, constants are given in centi-degrees
+template <typename T>
+struct ThermostatMath;
+
+template <>
+struct ThermostatMath<double> {
+    static constexpr double centi(int32_t value) {
+        return value / 100.0;
+    }
+    static double from(double value) {
+        return value;
+    }
+    static float to_float(double value) {
+        return value;
+    }
+    static double mul(double a, double b) {
+        return a * b;
+    }
+    static double div(double a, double b) {
+        return a / b;
+    }
+    static uint8_t floor(double value) {
+        return std::floor(std::min(255.0, std::max(0.0, value)));
+    }
+    static uint8_t ceil(double value) {
+        return std::ceil(std::min(255.0, std::max(0.0, value)));
+    }
+};
+
+template <>
+struct ThermostatMath<int32_t> {
+    static constexpr int32_t centi(int32_t value) {
+        return value;
+    }
+    static int32_t from(float value) {
+        return lroundf(value * 100);
+    }
+    static float to_float(int32_t value) {
+        return value / 100.0f;
+    }
+    static int32_t mul(int32_t a, int32_t b) {
+        return a * b / 100;
+    }
+    static int32_t div(int32_t a, int32_t b) {
+        return b == 0 ? 0 : a * 100 / b;
+    }
+    static uint8_t floor(int32_t value) {
+        return std::min<int32_t>(25500, std::max<int32_t>(0, value)) / 100;
+    }
+    static uint8_t ceil(int32_t value) {
+        return (std::min<int32_t>(25500, std::max<int32_t>(0, value)) + 99) / 100;
+    }
+};
+
+#if TOSHIBA_THERMOSTAT_FIXED_POINT
+using ThermostatScalar = int32_t;
+#else
+using ThermostatScalar = double;
+#endif
+
+template <typename T>
+struct ThermostatLawInput {
+    T target;
+    T room;
+    T idu_room;
+    T median_error;  // median offset of the IDU thermistor against the room sensor
+    T multiplier;
+    bool runaway_protection;
+    uint8_t min_setpoint;
+    uint8_t max_setpoint;
+};
+
+// hysteresis state carried between evaluations
+struct ThermostatLawState {
+    int8_t runaway_fix = 0;
+    int8_t rounding_mode = 0;
+};
+
+// the smart thermostat control law: the IDU setpoint for the given room and target temperature
+template <typename T>
+uint8_t smart_thermostat_law(const ThermostatLawInput<T>& in, ThermostatLawState& state, T& raw_setpoint) {
+    using M = ThermostatMath<T>;
+    T target_error = in.target - in.room;
+    T target_setpoint = in.target + in.median_error + M::mul(target_error, in.multiplier);
+
+    // occasionally, the devices suffer from thermal runaway. it will not perform the requested operation
+    // even if the error is significant and the setpoint is adjusted.
+    // below we fix this by setting a plausible, but significant change in target temperature.
+    // this can increase compressor cycles, but keeps the error in check.
+    if (in.runaway_protection) {
+        T threshold = std::max(M::centi(25), M::div(M::centi(100), in.multiplier));
+        if (target_error > threshold) {
+            state.runaway_fix = 1;
+        } else if (target_error < -threshold) {
+            state.runaway_fix = -1;
+        } else if (target_error < M::centi(15) && target_error > -M::centi(15)) {
+            state.runaway_fix = 0;
+        }
+
+        if (state.runaway_fix == 1) {
+            target_setpoint = std::max(in.target, target_setpoint);
+            target_setpoint = std::max(in.idu_room, target_setpoint);
+            target_setpoint = std::max(in.target + in.median_error, target_setpoint);
+            target_setpoint += M::centi(300);
+        } else if (state.runaway_fix == -1) {
+            target_setpoint = std::min(in.target, target_setpoint);
+            target_setpoint = std::min(in.idu_room, target_setpoint);
+            target_setpoint = std::min(in.target + in.median_error, target_setpoint);
+            target_setpoint -= M::centi(300);
         }
+    }
 
-        // if cooling mode is disabled, switch to fan only mode for unsupported modes
-        // we don't turn off the unit here, because it collides with the "power state before mode change" logic
-        if (this->config_settings_.disable_cooling_modes &&
-            (value == ToshibaMode::MODE_COOL || value == ToshibaMode::MODE_DRY ||
-             value == ToshibaMode::MODE_HEAT_COOL)) {
-            ESP_LOGI(TAG, "[REGISTER] received mode: %s, but cooling mode is disabled for this unit",
-                     format_hex_pretty((uint8_t)value).c_str());
-            this->mode = climate::CLIMATE_MODE_FAN_ONLY;
-            this->publish_state();
-            request_write_register_(ToshibaCommand::MODE, ToshibaMode::MODE_FAN_ONLY);
-            return;
+    // to account for the low 1°C precision of the device, we need to either ceil or floor the target.
+    // we switch only at extrema which ideally leads to a slow, but constant osciallation around the target
+    if (target_error > M::centi(20)) {
+        state.rounding_mode = 1;
+    } else if (target_error < -M::centi(20)) {
+        state.rounding_mode = -1;
+    }
+    uint8_t target_setpoint_int = state.rounding_mode == 1 ? M::ceil(target_setpoint) : M::floor(target_setpoint);
+
+    raw_setpoint = target_setpoint;
+    return std::max(in.min_setpoint, std::min(in.max_setpoint, target_setpoint_int));
+}
+
+// gains of the PID mode, in IDU setpoint °C per room °C. ki is per second and kd in seconds
+struct PidGains {
+    float kp;
+    float ki;
+    float kd;
+};
+
+struct PidInput {
+    float target;
+    float room;
+    float median_error;  // median offset of the IDU thermistor against the room sensor
+    uint8_t min_setpoint;
+    uint8_t max_setpoint;
+};
+
+struct PidState {
+    float integral = 0;
+    float last_room = NAN;
+    float derivative = 0;  // low-pass filtered room temperature slope, °C per second
+    uint32_t last_millis = 0;
+    int16_t last_output = -1;  // last quantised setpoint, -1 until the first evaluation
+};
+
+// an evaluation gap longer than this (mode changes, auto-tuning) does not count towards the integral
+static const uint32_t PID_MAX_STEP = 300000;
+// time constant of the derivative low-pass, room sensors report in 0.1°C steps
+static const float PID_DERIVATIVE_FILTER_SECONDS = 120.0f;
+// the IDU setpoint only moves once the raw output left the current 1°C step by this much
+static const float PID_QUANTISATION_HYSTERESIS = 0.6f;
+
+// PID alternative to smart_thermostat_law. works around the same feed forward (target plus thermistor offset),
+// the derivative acts on the room temperature only so target changes do not kick the setpoint
+inline uint8_t smart_thermostat_pid(const PidInput& in, const PidGains& gains, PidState& state, uint32_t now,
+                                    float& raw_setpoint) {
+    float error = in.target - in.room;
+    float dt = 0;
+    if (!std::isnan(state.last_room) && now - state.last_millis <= PID_MAX_STEP) {
+        dt = (now - state.last_millis) / 1000.0f;
+        if (dt > 0) {
+            float slope = (in.room - state.last_room) / dt;
+            state.derivative += (slope - state.derivative) * dt / (PID_DERIVATIVE_FILTER_SECONDS + dt);
+        }
+    } else {
+        state.derivative = 0;
+    }
+    state.last_room = in.room;
+    state.last_millis = now;
+
+    float base = in.target + in.median_error;
+    float output = base + gains.kp * error + state.integral - gains.kd * state.derivative;
+
+    // anti-windup: stop integrating while the output is saturated in the direction of the error
+    bool saturated_high = output >= in.max_setpoint && error > 0;
+    bool saturated_low = output <= in.min_setpoint && error < 0;
+    if (!saturated_high && !saturated_low) {
+        float span = in.max_setpoint - in.min_setpoint;
+        state.integral = std::max(-span, std::min(span, state.integral + gains.ki * error * dt));
+        output = base + gains.kp * error + state.integral - gains.kd * state.derivative;
+    }
+    raw_setpoint = output;
+
+    // quantise to the 1°C grid of the IDU, the hysteresis keeps noise from toggling between two steps
+    int16_t setpoint = state.last_output;
+    if (setpoint < 0 || std::fabs(output - setpoint) >= PID_QUANTISATION_HYSTERESIS) {
+        setpoint = lroundf(output);
+    }
+    setpoint = std::max<int16_t>(in.min_setpoint, std::min<int16_t>(in.max_setpoint, setpoint));
+    state.last_output = setpoint;
+    return setpoint;
+}
+
+// relay amplitude of the auto-tuner around the feed forward setpoint, in °C
+static const float PID_AUTOTUNE_AMPLITUDE = 2.0f;
+// the relay switches once the room left the target by this much, in °C
+static const float PID_AUTOTUNE_HYSTERESIS = 0.1f;
+// full oscillations averaged, the one that follows the start is discarded
+static const uint8_t PID_AUTOTUNE_CYCLES = 3;
+static const uint32_t PID_AUTOTUNE_TIMEOUT = 12 * 3600000;
+// oscillations smaller than this are sensor noise, not a limit cycle
+static const float PID_AUTOTUNE_MIN_AMPLITUDE = 0.15f;
+
+// Relay feedback auto-tuner (Åström–Hägglund). Drives the setpoint to +/- PID_AUTOTUNE_AMPLITUDE around the
+// feed forward until the room settles into a limit cycle, then derives gains from the ultimate gain
+// Ku = 4 d / (pi sqrt(a^2 - e^2)) and the ultimate period Tu.
+class RelayAutoTuner {
+public:
+    enum Result : uint8_t { AUTOTUNE_IDLE, AUTOTUNE_RUNNING, AUTOTUNE_DONE, AUTOTUNE_FAILED };
+
+    void start(float target, float room, uint32_t now) {
+        running_ = true;
+        relay_high_ = room < target;
+        start_millis_ = now;
+        last_rise_millis_ = 0;
+        rises_ = 0;
+        cycles_ = 0;
+        period_total_millis_ = 0;
+        amplitude_total_ = 0;
+        amplitude_ = 0;
+        period_seconds_ = 0;
+        reset_extrema_();
+    }
+
+    void abort() {
+        running_ = false;
+    }
+
+    bool running() const {
+        return running_;
+    }
+
+    uint8_t cycles() const {
+        return cycles_;
+    }
+
+    // advances the relay with a new room temperature, relay_offset is added to the feed forward setpoint
+    Result update(float target, float room, uint32_t now, float& relay_offset) {
+        if (!running_) {
+            return AUTOTUNE_IDLE;
+        }
+        if (now - start_millis_ > PID_AUTOTUNE_TIMEOUT) {
+            running_ = false;
+            return AUTOTUNE_FAILED;
+        }
+
+        room_max_ = std::max(room_max_, room);
+        room_min_ = std::min(room_min_, room);
+        if (!relay_high_ && room < target - PID_AUTOTUNE_HYSTERESIS) {
+            relay_high_ = true;
+            // a cycle spans two rising switches, the first one after the start is still settling
+            if (rises_ >= 2) {
+                period_total_millis_ += now - last_rise_millis_;
+                amplitude_total_ += (room_max_ - room_min_) / 2;
+                cycles_++;
+            }
+            rises_++;
+            last_rise_millis_ = now;
+            reset_extrema_();
+        } else if (relay_high_ && room > target + PID_AUTOTUNE_HYSTERESIS) {
+            relay_high_ = false;
         }
+        relay_offset = relay_high_ ? PID_AUTOTUNE_AMPLITUDE : -PID_AUTOTUNE_AMPLITUDE;
 
-        switch (value) {
-            case ToshibaMode::MODE_HEAT_COOL:
-                ESP_LOGI(TAG, "[REGISTER] received mode: %s", "HEAT_COOL");
-                this->mode = climate::CLIMATE_MODE_HEAT_COOL;
-                break;
-            case ToshibaMode::MODE_COOL:
-                ESP_LOGI(TAG, "[REGISTER] received mode: %s", "COOL");
-                this->mode = climate::CLIMATE_MODE_COOL;
-                break;
-            case ToshibaMode::MODE_HEAT:
-                ESP_LOGI(TAG, "[REGISTER] received mode: %s", "HEAT");
-                this->mode = climate::CLIMATE_MODE_HEAT;
-                break;
-            case ToshibaMode::MODE_DRY:
-                ESP_LOGI(TAG, "[REGISTER] received mode: %s", "DRY");
-                this->mode = climate::CLIMATE_MODE_DRY;
-                break;
-            case ToshibaMode::MODE_FAN_ONLY:
-                ESP_LOGI(TAG, "[REGISTER] received mode: %s", "FAN_ONLY");
-                this->mode = climate::CLIMATE_MODE_FAN_ONLY;
-                break;
-            default:
-                ESP_LOGE(TAG, "[REGISTER] received unknown mode: %s", format_hex_pretty((uint8_t)value).c_str());
-                this->mode = climate::CLIMATE_MODE_OFF;
-                break;
+        if (cycles_ < PID_AUTOTUNE_CYCLES) {
+            return AUTOTUNE_RUNNING;
         }
-        this->publish_state();
+        running_ = false;
+        amplitude_ = amplitude_total_ / cycles_;
+        period_seconds_ = period_total_millis_ / 1000.0f / cycles_;
+        return amplitude_ < PID_AUTOTUNE_MIN_AMPLITUDE ? AUTOTUNE_FAILED : AUTOTUNE_DONE;
     }
 
-    void handle_register_target_temperature(uint8_t value, bool is_external_change) {
-        ESP_LOGI(TAG, "[REGISTER] received target temperature: %d (external change: %s)", value,
-                 is_external_change ? "true" : "false");
+    float amplitude() const {
+        return amplitude_;
+    }
 
-        if (this->internal_special_mode_ == ToshibaSpecialModes::SPECIAL_MODE_EIGHT_DEGREES) {
-            this->internal_target_temperature_ = value - 16;
-        } else {
-            this->internal_target_temperature_ = value;
-        }
-        sensor_fcu_setpoint_temp_.publish_state(this->internal_target_temperature_);
+    float period_seconds() const {
+        return period_seconds_;
+    }
 
-        if (this->switch_internal_thermistor_.state ||
-            is_external_change) {  // only update the climate target temperature if the change was external (IR
-                                   // controller) or the internal temperature sensor is used
-            this->target_temperature = this->internal_target_temperature_;
-            this->publish_state();
+    float ultimate_gain() const {
+        float a = std::sqrt(std::max(amplitude_ * amplitude_ - PID_AUTOTUNE_HYSTERESIS * PID_AUTOTUNE_HYSTERESIS,
+                                     PID_AUTOTUNE_MIN_AMPLITUDE * PID_AUTOTUNE_MIN_AMPLITUDE));
+        return 4 * PID_AUTOTUNE_AMPLITUDE / (float(M_PI) * a);
+    }
+
+    // Tyreus–Luyben PI: Kp = Ku / 3.2, Ti = 2.2 Tu. Ziegler–Nichols tracks slightly faster but moves the 1°C
+    // setpoint ten times as often, each move can start or stop the compressor
+    PidGains gains() const {
+        float kp = ultimate_gain() / 3.2f;
+        return {kp, kp / (2.2f * period_seconds_), 0};
+    }
+
+private:
+    bool running_ = false;
+    bool relay_high_ = false;
+    uint32_t start_millis_ = 0;
+    uint32_t last_rise_millis_ = 0;
+    uint8_t rises_ = 0;
+    uint8_t cycles_ = 0;
+    uint32_t period_total_millis_ = 0;
+    float amplitude_total_ = 0;
+    float room_max_ = 0;
+    float room_min_ = 0;
+    float amplitude_ = 0;
+    float period_seconds_ = 0;
+
+    void reset_extrema_() {
+        room_max_ = -INFINITY;
+        room_min_ = INFINITY;
+    }
+};
+
+// the thermal model samples at this interval, shorter steps drown in the 0.1°C resolution of room sensors
+static const uint32_t THERMAL_MODEL_INTERVAL = 300000;
+// per sample weight of older samples, 0.995 keeps an effective memory of 200 samples (~17 h)
+static const float THERMAL_MODEL_FORGETTING = 0.995f;
+// regressors are centred here to keep the covariance well conditioned in float
+static const float THERMAL_MODEL_REFERENCE = 20.0f;
+// upper bound of the covariance trace, stops it from blowing up while the room sits at a constant setpoint
+static const float THERMAL_MODEL_MAX_TRACE = 1e4f;
+static const uint16_t THERMAL_MODEL_MIN_SAMPLES = 24;
+// plausible time constants, in seconds. outside of this range the fit is not used for predictions
+static const float THERMAL_MODEL_MIN_TAU = 600.0f;
+static const float THERMAL_MODEL_MAX_TAU = 48 * 3600.0f;
+// predictive overshoot prevention looks this far ahead, in seconds
+static const float THERMAL_PREDICTION_HORIZON = 3600.0f;
+// predicted crossings of the target by more than this are corrected, in °C
+static const float THERMAL_OVERSHOOT_MARGIN = 0.3f;
+
+// First order room model identified online by recursive least squares with exponential forgetting:
+//   T[k+1] = a T[k] + b_sp setpoint[k] + b_out outdoor[k] + c
+// Continuous form: time constant tau = -Ts / ln(a) and steady state gains b / (1 - a) from the IDU setpoint and
+// the outdoor temperature to the room temperature. All state is a 4x4 covariance and the parameter vector.
+class ThermalModel {
+public:
+    static const uint8_t N = 4;
+
+    ThermalModel() {
+        reset();
+    }
+
+    void reset() {
+        for (uint8_t i = 0; i < N; i++) {
+            theta_[i] = 0;
+            for (uint8_t j = 0; j < N; j++) {
+                p_[i][j] = i == j ? 100.0f : 0.0f;
+            }
         }
+        // start from a slow room that holds its temperature
+        theta_[0] = 1;
+        samples_ = 0;
     }
 
-    void handle_register_power_state(ToshibaState value) {
-        switch (value) {
-            case ToshibaState::STATE_ON:
-                ESP_LOGI(TAG, "[REGISTER] received power state: %s", "ON");
-                if (this->internal_power_state_ == ToshibaState::STATE_OFF) {
-                    request_read_register_(ToshibaCommand::MODE);
-                    request_read_register_(ToshibaCommand::TARGET_TEMPERATURE);
+    // fits the transition from the regressors of the previous sample to the room temperature of this one
+    void update(float room, float setpoint, float outdoor, float next_room) {
+        float phi[N] = {room - THERMAL_MODEL_REFERENCE, setpoint - THERMAL_MODEL_REFERENCE,
+                        outdoor - THERMAL_MODEL_REFERENCE, 1};
+        float p_phi[N];
+        float denominator = THERMAL_MODEL_FORGETTING;
+        for (uint8_t i = 0; i < N; i++) {
+            p_phi[i] = 0;
+            for (uint8_t j = 0; j < N; j++) {
+                p_phi[i] += p_[i][j] * phi[j];
+            }
+            denominator += phi[i] * p_phi[i];
+        }
+
+        float error = next_room - THERMAL_MODEL_REFERENCE;
+        for (uint8_t i = 0; i < N; i++) {
+            error -= theta_[i] * phi[i];
+        }
+        for (uint8_t i = 0; i < N; i++) {
+            theta_[i] += p_phi[i] / denominator * error;
+        }
+
+        // P = (P - P phi phi' P / denominator) / lambda, kept symmetric by construction
+        float trace = 0;
+        for (uint8_t i = 0; i < N; i++) {
+            for (uint8_t j = i; j < N; j++) {
+                float value = (p_[i][j] - p_phi[i] * p_phi[j] / denominator) / THERMAL_MODEL_FORGETTING;
+                p_[i][j] = value;
+                p_[j][i] = value;
+            }
+            trace += p_[i][i];
+        }
+        if (trace > THERMAL_MODEL_MAX_TRACE) {
+            float scale = THERMAL_MODEL_MAX_TRACE / trace;
+            for (auto& row : p_) {
+                for (float& value : row) {
+                    value *= scale;
                 }
-                break;
-            case ToshibaState::STATE_OFF:
-                ESP_LOGI(TAG, "[REGISTER] received power state: %s", "OFF");
-                this->mode = climate::CLIMATE_MODE_OFF;
-                this->publish_state();
-                break;
-            default:
-                ESP_LOGE(TAG, "[REGISTER] received unknown power state: %s", format_hex_pretty((uint8_t)value).c_str());
-                break;
+            }
         }
-        this->internal_power_state_ = value;
-    }
 
-    void handle_register_fan_mode(ToshibaFanMode value) {
-        switch (value) {
-            case ToshibaFanMode::FAN_AUTO:
-                ESP_LOGI(TAG, "[REGISTER] received fan mode: %s", "FAN_MODE_AUTO");
-                this->set_fan_mode_(climate::CLIMATE_FAN_AUTO);
-                break;
-            case ToshibaFanMode::FAN_QUIET:
-                ESP_LOGI(TAG, "[REGISTER] received fan mode: %s", "FAN_MODE_QUIET");
-                this->set_fan_mode_(climate::CLIMATE_FAN_QUIET);
-                break;
-            case ToshibaFanMode::FAN_LOW:
-                ESP_LOGI(TAG, "[REGISTER] received fan mode: %s", "FAN_MODE_LOW");
-                this->set_fan_mode_(climate::CLIMATE_FAN_LOW);
-                break;
-            case ToshibaFanMode::FAN_LOW_MEDIUM:
-                ESP_LOGI(TAG, "[REGISTER] received fan mode: %s", "CUSTOM_FAN_MODE_LOW_MEDIUM");
-                this->set_custom_fan_mode_(CUSTOM_FAN_MODE_LOW_MEDIUM);
-                break;
-            case ToshibaFanMode::FAN_MEDIUM:
-                ESP_LOGI(TAG, "[REGISTER] received fan mode: %s", "FAN_MODE_MEDIUM");
-                this->set_fan_mode_(climate::CLIMATE_FAN_MEDIUM);
-                break;
-            case ToshibaFanMode::FAN_MEDIUM_HIGH:
-                ESP_LOGI(TAG, "[REGISTER] received fan mode: %s", "CUSTOM_FAN_MODE_MEDIUM_HIGH");
-                this->set_custom_fan_mode_(CUSTOM_FAN_MODE_MEDIUM_HIGH);
-                break;
-            case ToshibaFanMode::FAN_HIGH:
-                ESP_LOGI(TAG, "[REGISTER] received fan mode: %s", "FAN_MODE_HIGH");
-                this->set_fan_mode_(climate::CLIMATE_FAN_HIGH);
-                break;
-            default:
-                ESP_LOGE(TAG, "[REGISTER] received unknown fan mode: %s", format_hex_pretty((uint8_t)value).c_str());
-                break;
+        for (float value : theta_) {
+            if (!std::isfinite(value)) {
+                reset();
+                return;
+            }
         }
+        if (samples_ < UINT16_MAX) {
+            samples_++;
+        }
+    }
 
-        this->publish_state();
-        this->internal_fan_mode_ = value;
+    uint16_t samples() const {
+        return samples_;
     }
 
-    void handle_register_swing_mode(ToshibaSwingMode value) {
-        switch (value) {
-            case ToshibaSwingMode::SWING_MODE_OFF:
-                ESP_LOGI(TAG, "[REGISTER] received swing mode: %s", "OFF");
-                this->swing_mode = climate::CLIMATE_SWING_OFF;
-                break;
-            case ToshibaSwingMode::SWING_MODE_SWING_VERTICAL:
-                ESP_LOGI(TAG, "[REGISTER] received swing mode: %s", "SWING_VERTICAL");
-                this->swing_mode = climate::CLIMATE_SWING_VERTICAL;
-                break;
-            case ToshibaSwingMode::SWING_MODE_SWING_HORIZONTAL:
-                ESP_LOGI(TAG, "[REGISTER] received swing mode: %s", "SWING_HORIZONTAL");
-                this->swing_mode = climate::CLIMATE_SWING_HORIZONTAL;
-                break;
-            case ToshibaSwingMode::SWING_MODE_SWING_VERTICAL_AND_HORIZONTAL:
-                ESP_LOGI(TAG, "[REGISTER] received swing mode: %s", "SWING_VERTICAL_AND_HORIZONTAL");
-                this->swing_mode = climate::CLIMATE_SWING_BOTH;
-                break;
-            case ToshibaSwingMode::SWING_MODE_FIXED_1:
-                ESP_LOGI(TAG, "[REGISTER] received swing mode: %s", "FIXED_1");
-                this->swing_mode = climate::CLIMATE_SWING_OFF;
-                break;
-            case ToshibaSwingMode::SWING_MODE_FIXED_2:
-                ESP_LOGI(TAG, "[REGISTER] received swing mode: %s", "FIXED_2");
-                this->swing_mode = climate::CLIMATE_SWING_OFF;
-                break;
-            case ToshibaSwingMode::SWING_MODE_FIXED_3:
-                ESP_LOGI(TAG, "[REGISTER] received swing mode: %s", "FIXED_3");
-                this->swing_mode = climate::CLIMATE_SWING_OFF;
-                break;
-            case ToshibaSwingMode::SWING_MODE_FIXED_4:
-                ESP_LOGI(TAG, "[REGISTER] received swing mode: %s", "FIXED_4");
-                this->swing_mode = climate::CLIMATE_SWING_OFF;
-                break;
-            case ToshibaSwingMode::SWING_MODE_FIXED_5:
-                ESP_LOGI(TAG, "[REGISTER] received swing mode: %s", "FIXED_5");
-                this->swing_mode = climate::CLIMATE_SWING_OFF;
-                break;
-            default:
-                ESP_LOGE(TAG, "[REGISTER] received unknown swing mode: %s", format_hex_pretty((uint8_t)value).c_str());
-                break;
+    // time constant in seconds, NAN while the room does not look like a stable first order system
+    float time_constant() const {
+        float a = theta_[0];
+        if (a <= 0 || a >= 1) {
+            return NAN;
         }
-        this->publish_state();
-        this->internal_swing_mode_ = value;
+        return -(THERMAL_MODEL_INTERVAL / 1000.0f) / std::log(a);
     }
 
-    void handle_register_special_mode(ToshibaSpecialModes value) {
-        switch (value) {
-            case ToshibaSpecialModes::SPECIAL_MODE_STANDARD:
-                ESP_LOGI(TAG, "[REGISTER] received special mode: %s", "STANDARD");
-                this->special_mode_select_->publish_state("Standard");
-                break;
-            case ToshibaSpecialModes::SPECIAL_MODE_HIGH_POWER:
-                ESP_LOGI(TAG, "[REGISTER] received special mode: %s", "HIGH_POWER");
-                this->special_mode_select_->publish_state("High Power");
-                break;
-            case ToshibaSpecialModes::SPECIAL_MODE_ECO:
-                ESP_LOGI(TAG, "[REGISTER] received special mode: %s", "ECO");
-                this->special_mode_select_->publish_state("Eco");
-                break;
-            case ToshibaSpecialModes::SPECIAL_MODE_EIGHT_DEGREES:
-                ESP_LOGI(TAG, "[REGISTER] received special mode: %s", "EIGHT_DEGREES");
-                this->special_mode_select_->publish_state("8 Degrees");
-                break;
-            case ToshibaSpecialModes::SPECIAL_MODE_FIREPLACE_1:
-                ESP_LOGI(TAG, "[REGISTER] received special mode: %s", "FIREPLACE_1");
-                this->special_mode_select_->publish_state("Fireplace 1");
-                break;
-            case ToshibaSpecialModes::SPECIAL_MODE_FIREPLACE_2:
-                ESP_LOGI(TAG, "[REGISTER] received special mode: %s", "FIREPLACE_2");
-                this->special_mode_select_->publish_state("Fireplace 2");
-                break;
-            case ToshibaSpecialModes::SPECIAL_MODE_SILENT_1:
-                ESP_LOGI(TAG, "[REGISTER] received special mode: %s", "SILENT_1");
-                this->special_mode_select_->publish_state("Silent 1");
-                break;
-            case ToshibaSpecialModes::SPECIAL_MODE_SILENT_2:
-                ESP_LOGI(TAG, "[REGISTER] received special mode: %s", "SILENT_2");
-                this->special_mode_select_->publish_state("Silent 2");
-                break;
-            case ToshibaSpecialModes::SPECIAL_MODE_SLEEP_CARE:
-                ESP_LOGI(TAG, "[REGISTER] received special mode: %s", "SLEEP_CARE");
-                this->special_mode_select_->publish_state("Sleep Care");
-                break;
-            case ToshibaSpecialModes::SPECIAL_MODE_FLOOR:
-                ESP_LOGI(TAG, "[REGISTER] received special mode: %s", "FLOOR");
-                this->special_mode_select_->publish_state("Floor");
-                break;
-            case ToshibaSpecialModes::SPECIAL_MODE_COMFORT:
-                ESP_LOGI(TAG, "[REGISTER] received special mode: %s", "COMFORT");
-                this->special_mode_select_->publish_state("Comfort");
-                break;
-            default:
-                ESP_LOGE(TAG, "[REGISTER] received unknown special mode: %s",
-                         format_hex_pretty((uint8_t)value).c_str());
-                break;
-        }
-        this->internal_special_mode_ = value;
+    float setpoint_gain() const {
+        return theta_[1] / (1 - theta_[0]);
     }
 
-    void handle_register_ionizer(ToshibaIonizer value) {
-        switch (value) {
-            case ToshibaIonizer::IONIZER_ON:
-                ESP_LOGI(TAG, "[REGISTER] received ionizer state: %s", "ON");
-                switch_ionizer_.publish_state(true);
-                break;
-            case ToshibaIonizer::IONIZER_OFF:
-                ESP_LOGI(TAG, "[REGISTER] received ionizer state: %s", "OFF");
-                switch_ionizer_.publish_state(false);
-                break;
-            default:
-                ESP_LOGE(TAG, "[REGISTER] received unknown ionizer state: %s",
-                         format_hex_pretty((uint8_t)value).c_str());
-                break;
+    float outdoor_gain() const {
+        return theta_[2] / (1 - theta_[0]);
+    }
+
+    bool valid() const {
+        float tau = time_constant();
+        return samples_ >= THERMAL_MODEL_MIN_SAMPLES && tau >= THERMAL_MODEL_MIN_TAU && tau <= THERMAL_MODEL_MAX_TAU &&
+               setpoint_gain() > 0;
+    }
+
+    // room temperature after horizon seconds at a constant setpoint and outdoor temperature
+    float predict(float room, float setpoint, float outdoor, float horizon) const {
+        float steady = THERMAL_MODEL_REFERENCE + (theta_[1] * (setpoint - THERMAL_MODEL_REFERENCE) +
+                                                  theta_[2] * (outdoor - THERMAL_MODEL_REFERENCE) + theta_[3]) /
+                                                     (1 - theta_[0]);
+        return steady + (room - steady) * std::exp(-horizon / time_constant());
+    }
+
+    // setpoint that brings the room to goal after horizon seconds, the prediction is linear in the setpoint
+    float setpoint_for(float room, float outdoor, float horizon, float goal) const {
+        float predicted = predict(room, THERMAL_MODEL_REFERENCE, outdoor, horizon);
+        return THERMAL_MODEL_REFERENCE +
+               (goal - predicted) / (setpoint_gain() * (1 - std::exp(-horizon / time_constant())));
+    }
+
+private:
+    float theta_[N];
+    float p_[N][N];
+    uint16_t samples_ = 0;
+};
+
+// Statically sized ring of TX frames, replaces a vector of vectors to keep the heap untouched while polling.
+// When full, new frames are rejected (drop newest) so queued frames keep their order; rejects are counted.
+template <uint8_t N>
+class TxFrameRing {
+    TxFrame slots_[N];
+    uint8_t head_ = 0;
+    uint8_t size_ = 0;
+    uint32_t overflow_count_ = 0;
+
+public:
+    bool push(const uint8_t* data, uint8_t len, TxFrameKind kind = TX_FRAME_RAW, uint8_t command = 0) {
+        if (size_ == N || len > TX_FRAME_MAX_LEN) {
+            overflow_count_++;
+            return false;
+        }
+        TxFrame& slot = slots_[(head_ + size_) % N];
+        memcpy(slot.data, data, len);
+        slot.len = len;
+        slot.kind = kind;
+        slot.command = command;
+        size_++;
+        return true;
+    }
+
+    // returns the queued frame of the given kind and command, nullptr if there is none
+    TxFrame* find(TxFrameKind kind, uint8_t command) {
+        for (uint8_t i = 0; i < size_; i++) {
+            TxFrame& slot = slots_[(head_ + i) % N];
+            if (slot.kind == kind && slot.command == command) {
+                return &slot;
+            }
+        }
+        return nullptr;
+    }
+
+    // removes the queued frame of the given kind and command, the frames behind it keep their order
+    bool remove(TxFrameKind kind, uint8_t command) {
+        for (uint8_t i = 0; i < size_; i++) {
+            const TxFrame& slot = slots_[(head_ + i) % N];
+            if (slot.kind != kind || slot.command != command) {
+                continue;
+            }
+            for (uint8_t j = i + 1; j < size_; j++) {
+                slots_[(head_ + j - 1) % N] = slots_[(head_ + j) % N];
+            }
+            size_--;
+            return true;
+        }
+        return false;
+    }
+
+    const TxFrame& front() const {
+        return slots_[head_];
+    }
+
+    void pop() {
+        if (size_ == 0) {
+            return;
+        }
+        head_ = (head_ + 1) % N;
+        size_--;
+    }
+
+    void clear() {
+        head_ = 0;
+        size_ = 0;
+    }
+
+    bool empty() const {
+        return size_ == 0;
+    }
+
+    uint8_t size() const {
+        return size_;
+    }
+
+    uint32_t overflow_count() const {
+        return overflow_count_;
+    }
+};
+
+enum ControlCommandType : uint8_t {
+    CONTROL_MODE,
+    CONTROL_TARGET_TEMPERATURE,
+    CONTROL_FAN_MODE,
+    CONTROL_CUSTOM_FAN_MODE,
+    CONTROL_SWING_MODE,
+    CONTROL_POWER_SELECT,
+    CONTROL_SWING_MODE_SELECT,
+    CONTROL_SPECIAL_MODE_SELECT,
+    CONTROL_IONIZER,
+    CONTROL_INTERNAL_THERMISTOR,
+    CONTROL_PID_AUTOTUNE,
+    CONTROL_PID_RESET_GAINS,
+};
+
+// a request from HA, a select or a switch, applied by loop()
+struct ControlCommand {
+    ControlCommandType type;
+    int32_t value;      // climate enum, ToshibaFanMode for custom fan modes, select index or switch state
+    float temperature;  // CONTROL_TARGET_TEMPERATURE only
+};
+
+static const uint8_t CONTROL_QUEUE_CAPACITY = 16;
+
+// Bounded multi producer, single consumer ring (Vyukov). Producers claim a cell by advancing enqueue_pos_ and
+// publish it through the cell's sequence number, so the consumer never sees a half written command.
+template <typename T, uint8_t N>
+class CommandRing {
+    static_assert((N & (N - 1)) == 0, "positions wrap at 2^32, capacity must be a power of two");
+
+    struct Cell {
+        std::atomic<uint32_t> sequence;
+        T value;
+    };
+    Cell cells_[N];
+    std::atomic<uint32_t> enqueue_pos_{0};
+    uint32_t dequeue_pos_ = 0;
+    std::atomic<uint32_t> overflow_count_{0};
+
+public:
+    CommandRing() {
+        for (uint32_t i = 0; i < N; i++) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // safe from any task or ISR, fails when full
+    bool push(const T& value) {
+        uint32_t pos;
+#ifdef USE_ESP32
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+        while (true) {
+            int32_t diff = cells_[pos % N].sequence.load(std::memory_order_acquire) - pos;
+            if (diff == 0) {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                overflow_count_.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+#else
+        {
+            // single core without tasks, only an ISR can interleave and the toolchain has no compare-and-swap
+            InterruptLock lock;
+            pos = enqueue_pos_.load(std::memory_order_relaxed);
+            if (int32_t(cells_[pos % N].sequence.load(std::memory_order_acquire) - pos) < 0) {
+                // read-modify-write is safe under the lock, fetch_add would need the missing atomic builtins
+                overflow_count_.store(overflow_count_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                return false;
+            }
+            enqueue_pos_.store(pos + 1, std::memory_order_relaxed);
+        }
+#endif
+        Cell& cell = cells_[pos % N];
+        cell.value = value;
+        cell.sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side, only called from loop()
+    bool pop(T& value) {
+        Cell& cell = cells_[dequeue_pos_ % N];
+        if (int32_t(cell.sequence.load(std::memory_order_acquire) - (dequeue_pos_ + 1)) < 0) {
+            return false;
+        }
+        value = cell.value;
+        cell.sequence.store(dequeue_pos_ + N, std::memory_order_release);
+        dequeue_pos_++;
+        return true;
+    }
+
+    uint32_t overflow_count() const {
+        return overflow_count_.load(std::memory_order_relaxed);
+    }
+};
+
+// the status command byte sits 10 bytes before the end of both 22 and 24 byte status frames
+static const uint8_t STATUS_FRAME_COMMAND_TAIL = 10;
+
+// Zero-copy view over an ODU_STATUS frame, base points at the command byte
+struct OduStatusView {
+    const uint8_t* base;
+
+    int8_t td() const {
+        return static_cast<int8_t>(base[1]);
+    }
+    int8_t ts() const {
+        return static_cast<int8_t>(base[2]);
+    }
+    int8_t te() const {
+        return static_cast<int8_t>(base[3]);
+    }
+    uint8_t load() const {
+        return base[4];
+    }
+    // not decoded yet (bytes 17 and 18 of the 22 byte frame)
+    uint8_t unknown_5() const {
+        return base[5];
+    }
+    uint8_t unknown_6() const {
+        return base[6];
+    }
+    uint8_t iac() const {
+        return base[7];
+    }
+    // not decoded yet (byte 20 of the 22 byte frame)
+    uint8_t unknown_8() const {
+        return base[8];
+    }
+};
+
+// Zero-copy view over an IDU_STATUS frame, base points at the command byte
+struct IduStatusView {
+    const uint8_t* base;
+
+    int8_t tc() const {
+        return static_cast<int8_t>(base[1]);
+    }
+    int8_t tcj() const {
+        return static_cast<int8_t>(base[2]);
+    }
+    uint8_t fan_rpm() const {
+        return base[3];
+    }
+};
+
+// all register commands live in the upper half of the command byte range
+static const uint8_t REGISTER_COMMAND_BASE = 0x80;
+static const uint8_t REGISTER_SLOT_NONE = 0xFF;
+
+// last received value of a register, used to suppress redundant state publishes
+struct RegisterShadow {
+    uint8_t value = 0;
+    bool valid = false;
+    bool received = false;  // value holds a received or restored value
+    bool stale = false;     // value was restored from the snapshot and not yet confirmed by the IDU
+    uint32_t last_recv_millis = 0;
+    uint32_t last_publish_millis = 0;
+};
+
+// a write waiting for its register echo, the climate keeps the optimistic state until then
+struct PendingWrite {
+    bool active = false;
+    bool sent = false;  // the latest attempt is on the wire
+    uint8_t value = 0;
+    uint8_t attempts = 0;
+    uint8_t priority = 0;
+    uint32_t first_sent_millis = 0;
+    uint32_t deadline_millis = 0;
+};
+
+struct WriteStats {
+    uint32_t confirmed = 0;
+    uint32_t retries = 0;
+    uint32_t failures = 0;
+    uint32_t latency_total_millis = 0;
+    uint32_t latency_max_millis = 0;
+};
+
+// polling interval bounds in seconds, the interval halves on changes and doubles while the value is stable
+struct PollProfile {
+    uint16_t min_interval;
+    uint16_t max_interval;
+    uint16_t start_interval;  // after the initial read, stable registers start slow and only changes shorten it
+    uint8_t priority;         // higher priorities are queued first when several registers are due
+};
+
+struct PollState {
+    uint32_t interval_millis = 0;
+    uint32_t deadline_millis = 0;
+    uint32_t push_count = 0;  // unsolicited updates, pushed registers keep moving their deadline and are not polled
+};
+
+// where a decoded register value is published
+enum RegisterTarget : uint8_t {
+    REGISTER_TARGET_NONE,  // the handler publishes it
+    REGISTER_TARGET_CLIMATE_MODE,
+    REGISTER_TARGET_CLIMATE_FAN_MODE,  // negative states publish the label as custom fan mode
+    REGISTER_TARGET_CLIMATE_SWING_MODE,
+    REGISTER_TARGET_SELECT,  // publishes the label as option
+    REGISTER_TARGET_SWITCH,
+    REGISTER_TARGET_SENSOR,
+    REGISTER_TARGET_SIGNED_SENSOR,
+};
+
+// one known value of an enum register
+struct RegisterValue {
+    uint8_t raw;
+    const char* label;
+    int8_t state;  // climate enum or switch state published for it
+};
+
+struct RegisterValueMap {
+    const RegisterValue* values = nullptr;
+    uint8_t count = 0;
+
+    constexpr RegisterValueMap() = default;
+    template <size_t N>
+    constexpr RegisterValueMap(const RegisterValue (&values)[N]) : values(values), count(N) {}
+
+    const RegisterValue* find(uint8_t raw) const {
+        for (uint8_t i = 0; i < count; i++) {
+            if (values[i].raw == raw) {
+                return &values[i];
+            }
+        }
+        return nullptr;
+    }
+};
+
+// the entity of select, switch and sensor targets, the target picks the member
+union RegisterEntity {
+    esphome::template_::TemplateSelect* ToshibaController::*select;
+    CustomSwitch ToshibaController::*switch_;
+    ShadowedSensor ToshibaController::*sensor;
+
+    constexpr RegisterEntity() : select(nullptr) {}
+    constexpr RegisterEntity(esphome::template_::TemplateSelect* ToshibaController::*select) : select(select) {}
+    constexpr RegisterEntity(CustomSwitch ToshibaController::*switch_) : switch_(switch_) {}
+    constexpr RegisterEntity(ShadowedSensor ToshibaController::*sensor) : sensor(sensor) {}
+};
+
+struct RegisterDescriptor {
+    ToshibaCommand command;
+    const char* name;
+    // side effects beyond publishing the value, decoded is nullptr for unknown enum values
+    void (ToshibaController::*handler)(uint8_t raw, const RegisterValue* decoded, bool is_external_change);
+    bool snapshot;  // changes are persisted to flash, volatile readings only ride along
+    PollProfile poll;
+    RegisterTarget target = REGISTER_TARGET_NONE;
+    RegisterValueMap values = {};
+    RegisterEntity entity = {};
+
+    constexpr bool has_value() const {
+        return handler != nullptr || target != REGISTER_TARGET_NONE;
+    }
+};
+
+// maps (command - REGISTER_COMMAND_BASE) to the register's slot in ToshibaController::REGISTERS
+struct RegisterIndex {
+    uint8_t slots[256 - REGISTER_COMMAND_BASE];
+};
+
+template <size_t N>
+constexpr RegisterIndex build_register_index(const RegisterDescriptor (&registers)[N]) {
+    RegisterIndex index{};
+    for (auto& slot : index.slots) {
+        slot = REGISTER_SLOT_NONE;
+    }
+    for (size_t i = 0; i < N; i++) {
+        index.slots[registers[i].command - REGISTER_COMMAND_BASE] = i;
+    }
+    return index;
+}
+
+// read requests of all registers, in slot order
+template <size_t N>
+constexpr std::array<ReadFrame, N> build_read_frames(const RegisterDescriptor (&registers)[N]) {
+    std::array<ReadFrame, N> frames{};
+    for (size_t i = 0; i < N; i++) {
+        frames[i] = make_read_frame(registers[i].command);
+    }
+    return frames;
+}
+
+// time source of the controller, a host simulation injects its own to run days of operation in seconds
+class ToshibaClock {
+public:
+    virtual ~ToshibaClock() = default;
+    virtual uint32_t millis() const = 0;
+};
+
+class SystemClock final : public ToshibaClock {
+public:
+    uint32_t millis() const override {
+        return esphome::millis();
+    }
+};
+
+class ToshibaController final : public climate::Climate, public Component {
+    climate::ClimateTraits supported_traits_;
+
+    SystemClock system_clock_;
+    const ToshibaClock* clock_ = &system_clock_;
+
+    uint32_t now_millis_() const {
+        return clock_->millis();
+    }
+
+    esphome::uart::UARTComponent* serial_;
+    esphome::sensor::Sensor* temperature_sensor_;
+    esphome::template_::TemplateSelect* swing_mode_select_;
+    esphome::template_::TemplateSelect* special_mode_select_;
+    esphome::template_::TemplateSelect* power_selection_select_;
+
+    uint32_t last_external_temperature_sensor_control_millis_ = 0;
+
+    CustomSwitch switch_internal_thermistor_;
+    CustomSwitch switch_ionizer_;
+
+    uint8_t recv_buf_[256] = {};
+    RxShared<uint32_t> recv_buf_len_{0};
+    RxShared<uint32_t> last_recv_millis_{0};
+    RxShared<uint32_t> rx_resync_count_{0};
+    uint32_t last_rx_poll_millis_ = 0;
+    uint32_t rx_poll_gap_millis_ = 0;
+    // time a complete frame waited before it was handled, bounded by the loop() period without the RX task
+    LatencyHistogram rx_dispatch_histogram_;
+    LatencyHistogram tx_turnaround_histogram_;
+#ifdef USE_ESP32
+    TaskHandle_t rx_task_ = nullptr;
+    RxFrameQueue<RX_TASK_QUEUE_LEN> rx_task_frames_;
+    RxShared<uint32_t> rx_task_drops_{0};
+#endif
+    // running checksum sum of recv_buf_[1..recv_sum_len_), bytes of valid frames are summed only once
+    uint8_t recv_sum_ = 0;
+    uint32_t recv_sum_len_ = 1;
+
+    TxFrameRing<TX_QUEUE_CAPACITY> send_msg_queue_[TX_PRIORITY_COUNT];
+    uint8_t tx_starved_[TX_PRIORITY_COUNT] = {};
+    uint8_t tx_queue_high_water_[TX_PRIORITY_COUNT] = {};
+    uint32_t tx_sent_count_[TX_PRIORITY_COUNT] = {};
+    uint32_t last_sent_millis_ = 0;
+    // ack pacing: the frame awaiting its response and the learned IDU turnaround time
+    bool tx_awaiting_ack_ = false;
+    TxFrameKind tx_awaiting_kind_ = TX_FRAME_RAW;
+    uint8_t tx_awaiting_command_ = 0;
+    uint32_t tx_turnaround_millis_ = TX_FRAME_GAP / 2;  // exponential moving average
+    uint32_t tx_ack_count_ = 0;
+    uint32_t tx_ack_timeout_count_ = 0;
+
+    ConfigSettings config_settings_;
+
+    ToshibaState internal_power_state_ = ToshibaState::STATE_OFF;
+    ToshibaFanMode internal_fan_mode_ = ToshibaFanMode::FAN_MEDIUM;
+    ToshibaSwingMode internal_swing_mode_ = ToshibaSwingMode::SWING_MODE_OFF;
+    ToshibaSpecialModes internal_special_mode_ = ToshibaSpecialModes::SPECIAL_MODE_STANDARD;
+    ToshibaPowerSelection internal_power_selection_ = ToshibaPowerSelection::POWER_100;
+    uint8_t internal_target_temperature_ = 20;
+
+    bool is_initialized_ = false;
+
+    HandshakeState handshake_state_ = HandshakeState::HANDSHAKE_BOOT;
+    uint32_t handshake_state_millis_ = 0;
+    uint8_t handshake_attempts_ = 0;
+    bool handshake_reply_received_ = false;
+    bool post_handshake_reply_received_ = false;
+
+    int8_t internal_idu_room_temperature_ = 0;
+
+    ShadowedSensor sensor_outdoor_temperature_;
+    ShadowedSensor sensor_cdu_td_temp_;
+    ShadowedSensor sensor_cdu_ts_temp_;
+    ShadowedSensor sensor_cdu_te_temp_;
+    ShadowedSensor sensor_cdu_load_;
+    ShadowedSensor sensor_cdu_iac_;
+    ShadowedSensor sensor_fcu_air_temp_;
+    ShadowedSensor sensor_fcu_setpoint_temp_;
+    ShadowedSensor sensor_fcu_tc_temp_;
+    ShadowedSensor sensor_fcu_tcj_temp_;
+    ShadowedSensor sensor_fcu_fan_rpm_;
+    sensor::Sensor sensor_rx_resyncs_;
+    sensor::Sensor sensor_thermal_time_constant_;
+    sensor::Sensor sensor_thermal_setpoint_gain_;
+    sensor::Sensor sensor_thermal_outdoor_gain_;
+
+    uint64_t loop_cnt_ = 0;
+
+    // climate state changes only mark the entity dirty, loop() publishes at most once per iteration
+    bool publish_pending_ = false;
+    uint32_t publish_request_count_ = 0;
+    uint32_t publish_count_ = 0;
+    uint32_t last_statistics_log_millis_ = 0;
+
+    void schedule_publish_() {
+        this->publish_pending_ = true;
+        this->publish_request_count_++;
+    }
+
+    void flush_publish_() {
+        if (!this->publish_pending_) {
+            return;
+        }
+        this->publish_pending_ = false;
+        this->publish_count_++;
+        this->publish_state();
+    }
+
+    void log_statistics_() {
+        if (now_millis_() - last_statistics_log_millis_ < 60000) {
+            return;
+        }
+        last_statistics_log_millis_ = now_millis_();
+        ESP_LOGD(TAG, "[STATS] climate publishes: %d of %d requested (%d coalesced)", publish_count_,
+                 publish_request_count_, publish_request_count_ - publish_count_);
+        ESP_LOGD(TAG, "[STATS] control commands: %d applied, %d dropped", control_count_,
+                 control_queue_.overflow_count());
+        static const char* const TX_PRIORITY_NAMES[TX_PRIORITY_COUNT] = {"user", "protocol", "polling"};
+        for (uint8_t priority = 0; priority < TX_PRIORITY_COUNT; priority++) {
+            ESP_LOGD(TAG, "[STATS] tx %s queue: %d queued (max %d), %d sent, %d dropped", TX_PRIORITY_NAMES[priority],
+                     send_msg_queue_[priority].size(), tx_queue_high_water_[priority], tx_sent_count_[priority],
+                     send_msg_queue_[priority].overflow_count());
+        }
+        ESP_LOGD(TAG, "[STATS] tx responses: %d, response timeouts: %d, idu turnaround avg %d ms", tx_ack_count_,
+                 tx_ack_timeout_count_, tx_turnaround_millis_);
+        tx_turnaround_histogram_.log("idu turnaround");
+        ESP_LOGD(TAG, "[STATS] rx resyncs: %d", uint32_t(rx_resync_count_));
+#ifdef USE_ESP32
+        if (rx_task_ != nullptr) {
+            ESP_LOGD(TAG, "[STATS] rx task frames dropped: %d", uint32_t(rx_task_drops_));
+        }
+#endif
+        rx_dispatch_histogram_.log("rx dispatch delay");
+        for (uint8_t slot = 0; slot < REGISTER_COUNT; slot++) {
+            if (tx_write_merges_[slot] > 0 || tx_read_drops_[slot] > 0) {
+                ESP_LOGD(TAG, "[STATS] %s: %d writes merged, %d duplicate reads dropped", REGISTERS[slot].name,
+                         tx_write_merges_[slot], tx_read_drops_[slot]);
+            }
+            const WriteStats& writes = write_stats_[slot];
+            if (writes.confirmed > 0 || writes.failures > 0) {
+                ESP_LOGD(TAG, "[STATS] %s: %d writes confirmed (avg %d ms, max %d ms), %d retries, %d failed",
+                         REGISTERS[slot].name, writes.confirmed,
+                         writes.confirmed > 0 ? writes.latency_total_millis / writes.confirmed : 0,
+                         writes.latency_max_millis, writes.retries, writes.failures);
+            }
+        }
+    }
+
+    bool tx_queues_empty_() const {
+        for (const auto& queue : send_msg_queue_) {
+            if (!queue.empty()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void clear_tx_queues_() {
+        for (auto& queue : send_msg_queue_) {
+            queue.clear();
+        }
+    }
+
+    // highest non-empty class, unless a lower class waited for too many frames
+    int8_t next_tx_priority_() {
+        for (int8_t priority = TX_PRIORITY_COUNT - 1; priority >= 0; priority--) {
+            if (!send_msg_queue_[priority].empty() && tx_starved_[priority] >= TX_STARVATION_LIMIT) {
+                return priority;
+            }
+        }
+        for (int8_t priority = 0; priority < TX_PRIORITY_COUNT; priority++) {
+            if (!send_msg_queue_[priority].empty()) {
+                return priority;
+            }
+        }
+        return -1;
+    }
+
+    uint32_t tx_ack_timeout_() const {
+        return std::min(TX_ACK_MAX_TIMEOUT, std::max(TX_FRAME_GAP, 2 * tx_turnaround_millis_ + TX_ACK_MARGIN));
+    }
+
+    // called for every received frame, releases the TX path if it answers the frame sent last
+    void note_tx_response_(TxFrameKind kind, uint8_t command) {
+        if (!tx_awaiting_ack_ || kind != tx_awaiting_kind_ || command != tx_awaiting_command_) {
+            return;
+        }
+        uint32_t turnaround = now_millis_() - last_sent_millis_;
+        tx_turnaround_millis_ = (tx_turnaround_millis_ * 7 + turnaround) / 8;
+        tx_turnaround_histogram_.add(turnaround);
+        tx_awaiting_ack_ = false;
+        tx_ack_count_++;
+        ESP_LOGV(TAG, "response after %d ms (avg %d ms)", turnaround, tx_turnaround_millis_);
+    }
+
+    bool tx_ready_() {
+        if (recv_buf_len_ > 0) {
+            return false;
+        }
+        if (!this->config_settings_.ack_paced_tx) {
+            return now_millis_() - last_sent_millis_ >= TX_FRAME_GAP && now_millis_() - last_recv_millis_ >= TX_FRAME_GAP;
+        }
+        if (tx_awaiting_ack_) {
+            if (now_millis_() - last_sent_millis_ < tx_ack_timeout_()) {
+                return false;
+            }
+            ESP_LOGD(TAG, "no response within %d ms, sending next frame", tx_ack_timeout_());
+            tx_awaiting_ack_ = false;
+            tx_ack_timeout_count_++;
+        }
+        return now_millis_() - last_recv_millis_ >= TX_ACK_GUARD;
+    }
+
+    void process_uart_tx() {
+        if (!tx_ready_()) {
+            return;
+        }
+
+        int8_t priority = next_tx_priority_();
+        if (priority < 0) {
+            return;
+        }
+
+        auto& queue = send_msg_queue_[priority];
+        const TxFrame& frame = queue.front();
+        ESP_LOGD(TAG, "sending: %s", format_hex_pretty(frame.data, frame.len).c_str());
+        last_sent_millis_ = now_millis_();
+        serial_->write_array(frame.data, frame.len);
+        tx_awaiting_ack_ = true;
+        tx_awaiting_kind_ = frame.kind;
+        tx_awaiting_command_ = frame.command;
+        if (frame.kind == TX_FRAME_WRITE) {
+            note_write_sent_(frame.command);
+        }
+        queue.pop();
+        tx_sent_count_[priority]++;
+        tx_starved_[priority] = 0;
+        for (uint8_t lower = priority + 1; lower < TX_PRIORITY_COUNT; lower++) {
+            if (!send_msg_queue_[lower].empty()) {
+                tx_starved_[lower]++;
+            }
+        }
+        ESP_LOGD(TAG, "finished sending");
+    }
+
+    // publishes a register value to the target of its table entry, the handler runs after it and may override
+    void apply_register_(uint8_t slot, uint8_t raw, bool is_external_change) {
+        const RegisterDescriptor& reg = REGISTERS[slot];
+        const RegisterValue* decoded = reg.values.find(raw);
+        if (decoded != nullptr) {
+            ESP_LOGI(TAG, "[REGISTER] received %s: %s", reg.name, decoded->label);
+        } else if (reg.values.count != 0) {
+            ESP_LOGE(TAG, "[REGISTER] received unknown %s: %s", reg.name, format_hex_pretty(raw).c_str());
+        }
+
+        switch (reg.target) {
+            case REGISTER_TARGET_CLIMATE_MODE:
+                if (decoded != nullptr) {
+                    this->mode = static_cast<climate::ClimateMode>(decoded->state);
+                }
+                this->schedule_publish_();
+                break;
+            case REGISTER_TARGET_CLIMATE_FAN_MODE:
+                if (decoded != nullptr && decoded->state < 0) {
+                    this->set_custom_fan_mode_(decoded->label);
+                } else if (decoded != nullptr) {
+                    this->set_fan_mode_(static_cast<climate::ClimateFanMode>(decoded->state));
+                }
+                this->schedule_publish_();
+                break;
+            case REGISTER_TARGET_CLIMATE_SWING_MODE:
+                if (decoded != nullptr) {
+                    this->swing_mode = static_cast<climate::ClimateSwingMode>(decoded->state);
+                }
+                this->schedule_publish_();
+                break;
+            case REGISTER_TARGET_SELECT:
+                if (decoded != nullptr) {
+                    (this->*reg.entity.select)->publish_state(decoded->label);
+                }
+                break;
+            case REGISTER_TARGET_SWITCH:
+                if (decoded != nullptr) {
+                    (this->*reg.entity.switch_).publish_state(decoded->state != 0);
+                }
+                break;
+            case REGISTER_TARGET_SENSOR:
+                ESP_LOGI(TAG, "[REGISTER] received %s: %d", reg.name, raw);
+                publish_sensor_(this->*reg.entity.sensor, raw);
+                break;
+            case REGISTER_TARGET_SIGNED_SENSOR:
+                ESP_LOGI(TAG, "[REGISTER] received %s: %d", reg.name, (int8_t)raw);
+                publish_sensor_(this->*reg.entity.sensor, (int8_t)raw);
+                break;
+            case REGISTER_TARGET_NONE:
+                break;
+        }
+
+        if (reg.handler != nullptr) {
+            (this->*reg.handler)(raw, decoded, is_external_change);
+        }
+    }
+
+    void handle_register_mode(uint8_t raw, const RegisterValue* decoded, bool /*is_external_change*/) {
+        auto value = static_cast<ToshibaMode>(raw);
+        if (this->internal_power_state_ == ToshibaState::STATE_OFF) {
+            ESP_LOGE(TAG, "[REGISTER] received mode %s, but IDU is powered off", format_hex_pretty(raw).c_str());
+            this->mode = climate::CLIMATE_MODE_OFF;
+            return;
+        }
+
+        // if cooling mode is disabled, switch to fan only mode for unsupported modes
+        // we don't turn off the unit here, because it collides with the "power state before mode change" logic
+        if (this->config_settings_.disable_cooling_modes &&
+            (value == ToshibaMode::MODE_COOL || value == ToshibaMode::MODE_DRY ||
+             value == ToshibaMode::MODE_HEAT_COOL)) {
+            ESP_LOGI(TAG, "[REGISTER] received mode: %s, but cooling mode is disabled for this unit",
+                     format_hex_pretty(raw).c_str());
+            this->mode = climate::CLIMATE_MODE_FAN_ONLY;
+            request_write_register_(ToshibaCommand::MODE, ToshibaMode::MODE_FAN_ONLY, TX_PRIORITY_PROTOCOL);
+            return;
+        }
+
+        if (decoded == nullptr) {
+            this->mode = climate::CLIMATE_MODE_OFF;
+        }
+    }
+
+    void handle_register_target_temperature(uint8_t value, const RegisterValue* /*decoded*/,
+                                            bool is_external_change) {
+        ESP_LOGI(TAG, "[REGISTER] received target temperature: %d (external change: %s)", value,
+                 is_external_change ? "true" : "false");
+
+        if (this->internal_special_mode_ == ToshibaSpecialModes::SPECIAL_MODE_EIGHT_DEGREES) {
+            this->internal_target_temperature_ = value - 16;
+        } else {
+            this->internal_target_temperature_ = value;
+        }
+        publish_sensor_(sensor_fcu_setpoint_temp_, this->internal_target_temperature_);
+
+        if (this->switch_internal_thermistor_.state ||
+            is_external_change) {  // only update the climate target temperature if the change was external (IR
+                                   // controller) or the internal temperature sensor is used
+            this->target_temperature = this->internal_target_temperature_;
+            this->schedule_publish_();
+        }
+    }
+
+    void handle_register_power_state(uint8_t raw, const RegisterValue* /*decoded*/, bool /*is_external_change*/) {
+        auto value = static_cast<ToshibaState>(raw);
+        if (value == ToshibaState::STATE_ON && this->internal_power_state_ == ToshibaState::STATE_OFF) {
+            request_read_register_(ToshibaCommand::MODE, TX_PRIORITY_PROTOCOL);
+            request_read_register_(ToshibaCommand::TARGET_TEMPERATURE, TX_PRIORITY_PROTOCOL);
+        } else if (value == ToshibaState::STATE_OFF) {
+            this->mode = climate::CLIMATE_MODE_OFF;
+            this->schedule_publish_();
+        }
+        if (this->internal_power_state_ != value) {
+            // the mode handler depends on the power state
+            invalidate_register_(ToshibaCommand::MODE);
+        }
+        this->internal_power_state_ = value;
+    }
+
+    void handle_register_fan_mode(uint8_t raw, const RegisterValue* /*decoded*/, bool /*is_external_change*/) {
+        this->internal_fan_mode_ = static_cast<ToshibaFanMode>(raw);
+    }
+
+    void handle_register_swing_mode(uint8_t raw, const RegisterValue* /*decoded*/, bool /*is_external_change*/) {
+        this->internal_swing_mode_ = static_cast<ToshibaSwingMode>(raw);
+    }
+
+    void handle_register_special_mode(uint8_t raw, const RegisterValue* /*decoded*/, bool /*is_external_change*/) {
+        auto value = static_cast<ToshibaSpecialModes>(raw);
+        if (this->internal_special_mode_ != value) {
+            // the target temperature is offset in EIGHT_DEGREES mode
+            invalidate_register_(ToshibaCommand::TARGET_TEMPERATURE);
+        }
+        this->internal_special_mode_ = value;
+    }
+
+    void handle_register_power_selection(uint8_t raw, const RegisterValue* /*decoded*/,
+                                         bool /*is_external_change*/) {
+        this->internal_power_selection_ = static_cast<ToshibaPowerSelection>(raw);
+    }
+
+    void handle_register_room_temperature(uint8_t value, const RegisterValue* /*decoded*/,
+                                          bool /*is_external_change*/) {
+        if (this->internal_idu_room_temperature_ != (int8_t)value) {
+            note_thermostat_input_();
+        }
+        this->internal_idu_room_temperature_ = value;
+
+        if (this->switch_internal_thermistor_.state) {
+            this->current_temperature = (float)value;
+            this->schedule_publish_();
+        }
+    }
+
+    // status registers have no single value, their shadow holds a digest of the payload for change detection
+    void note_status_received_(const uint8_t* status, bool is_external_change) {
+        uint8_t slot = register_slot_(status[0]);
+        if (slot == REGISTER_SLOT_NONE) {
+            return;
+        }
+        uint8_t digest = 0;
+        for (uint8_t i = 1; i < STATUS_FRAME_COMMAND_TAIL - 1; i++) {
+            digest = (digest << 1 | digest >> 7) ^ status[i];
+        }
+        RegisterShadow& shadow = register_shadow_[slot];
+        update_poll_state_(slot, !shadow.received || shadow.value != digest, is_external_change);
+        shadow.value = digest;
+        shadow.received = true;
+        shadow.last_recv_millis = now_millis_();
+    }
+
+    void handle_odu_status(OduStatusView status, bool is_external_change) {
+        publish_sensor_(sensor_cdu_td_temp_, status.td());
+        publish_sensor_(sensor_cdu_ts_temp_, status.ts());
+        publish_sensor_(sensor_cdu_te_temp_, status.te());
+        // toshiba names this register "cduHz", however it ranges from
+        // 0-170 for different ODUs and is outside of the comp. range
+        publish_sensor_(sensor_cdu_load_, static_cast<float_t>(status.load()) / 1.7f);
+        // unsure, ranges from 0-68 and could be EEV actuation for this IDU
+        publish_sensor_(sensor_cdu_iac_, status.iac());
+        ESP_LOGI(TAG,
+                 "[REGISTERS_ODU%s] STATUS: cduTdTemp = %d, cduTsTemp = %d, cduTeTemp = %d, cduLoad = %d, cduIac = %d",
+                 is_external_change ? "" : "_REQ", (int32_t)sensor_cdu_td_temp_.get_state(),
+                 (int32_t)sensor_cdu_ts_temp_.get_state(), (int32_t)sensor_cdu_te_temp_.get_state(),
+                 (int32_t)sensor_cdu_load_.get_state(), (int32_t)sensor_cdu_iac_.get_state());
+        ESP_LOGV(TAG, "[REGISTERS_ODU] unknown bytes: %s %s %s", format_hex_pretty(status.unknown_5()).c_str(),
+                 format_hex_pretty(status.unknown_6()).c_str(), format_hex_pretty(status.unknown_8()).c_str());
+    }
+
+    void handle_idu_status(IduStatusView status, bool is_external_change) {
+        if ((status.fan_rpm() > 0) != thermostat_fan_running_) {
+            thermostat_fan_running_ = status.fan_rpm() > 0;
+            note_thermostat_input_();
+        }
+        publish_sensor_(sensor_fcu_tc_temp_, status.tc());
+        publish_sensor_(sensor_fcu_tcj_temp_, status.tcj());
+        publish_sensor_(sensor_fcu_fan_rpm_, status.fan_rpm());
+        ESP_LOGI(TAG, "[REGISTERS_IDU%s] STATUS: fcuTcTemp = %d, fcuTcjTemp = %d, fcuFanRpm = %d",
+                 is_external_change ? "" : "_REQ", (int32_t)sensor_fcu_tc_temp_.get_state(),
+                 (int32_t)sensor_fcu_tcj_temp_.get_state(), (int32_t)sensor_fcu_fan_rpm_.get_state());
+    }
+
+    static constexpr RegisterValue POWER_STATE_VALUES[] = {
+        {ToshibaState::STATE_ON, "ON", 1},
+        {ToshibaState::STATE_OFF, "OFF", 0},
+    };
+    static constexpr RegisterValue MODE_VALUES[] = {
+        {ToshibaMode::MODE_HEAT_COOL, "HEAT_COOL", climate::CLIMATE_MODE_HEAT_COOL},
+        {ToshibaMode::MODE_COOL, "COOL", climate::CLIMATE_MODE_COOL},
+        {ToshibaMode::MODE_HEAT, "HEAT", climate::CLIMATE_MODE_HEAT},
+        {ToshibaMode::MODE_DRY, "DRY", climate::CLIMATE_MODE_DRY},
+        {ToshibaMode::MODE_FAN_ONLY, "FAN_ONLY", climate::CLIMATE_MODE_FAN_ONLY},
+    };
+    // custom fan modes are published by label and must match CUSTOM_FAN_MODE_*
+    static constexpr RegisterValue FAN_MODE_VALUES[] = {
+        {ToshibaFanMode::FAN_AUTO, "Auto", climate::CLIMATE_FAN_AUTO},
+        {ToshibaFanMode::FAN_QUIET, "Quiet", climate::CLIMATE_FAN_QUIET},
+        {ToshibaFanMode::FAN_LOW, "Low", climate::CLIMATE_FAN_LOW},
+        {ToshibaFanMode::FAN_LOW_MEDIUM, "Low Medium", -1},
+        {ToshibaFanMode::FAN_MEDIUM, "Medium", climate::CLIMATE_FAN_MEDIUM},
+        {ToshibaFanMode::FAN_MEDIUM_HIGH, "Medium High", -1},
+        {ToshibaFanMode::FAN_HIGH, "High", climate::CLIMATE_FAN_HIGH},
+    };
+    // the fixed louver positions do not swing
+    static constexpr RegisterValue SWING_MODE_VALUES[] = {
+        {ToshibaSwingMode::SWING_MODE_OFF, "OFF", climate::CLIMATE_SWING_OFF},
+        {ToshibaSwingMode::SWING_MODE_SWING_VERTICAL, "SWING_VERTICAL", climate::CLIMATE_SWING_VERTICAL},
+        {ToshibaSwingMode::SWING_MODE_SWING_HORIZONTAL, "SWING_HORIZONTAL", climate::CLIMATE_SWING_HORIZONTAL},
+        {ToshibaSwingMode::SWING_MODE_SWING_VERTICAL_AND_HORIZONTAL, "SWING_VERTICAL_AND_HORIZONTAL",
+         climate::CLIMATE_SWING_BOTH},
+        {ToshibaSwingMode::SWING_MODE_FIXED_1, "FIXED_1", climate::CLIMATE_SWING_OFF},
+        {ToshibaSwingMode::SWING_MODE_FIXED_2, "FIXED_2", climate::CLIMATE_SWING_OFF},
+        {ToshibaSwingMode::SWING_MODE_FIXED_3, "FIXED_3", climate::CLIMATE_SWING_OFF},
+        {ToshibaSwingMode::SWING_MODE_FIXED_4, "FIXED_4", climate::CLIMATE_SWING_OFF},
+        {ToshibaSwingMode::SWING_MODE_FIXED_5, "FIXED_5", climate::CLIMATE_SWING_OFF},
+    };
+    // labels are the options of the special mode select
+    static constexpr RegisterValue SPECIAL_MODE_VALUES[] = {
+        {ToshibaSpecialModes::SPECIAL_MODE_STANDARD, "Standard", 0},
+        {ToshibaSpecialModes::SPECIAL_MODE_HIGH_POWER, "High Power", 0},
+        {ToshibaSpecialModes::SPECIAL_MODE_ECO, "Eco", 0},
+        {ToshibaSpecialModes::SPECIAL_MODE_EIGHT_DEGREES, "8 Degrees", 0},
+        {ToshibaSpecialModes::SPECIAL_MODE_FIREPLACE_1, "Fireplace 1", 0},
+        {ToshibaSpecialModes::SPECIAL_MODE_FIREPLACE_2, "Fireplace 2", 0},
+        {ToshibaSpecialModes::SPECIAL_MODE_SILENT_1, "Silent 1", 0},
+        {ToshibaSpecialModes::SPECIAL_MODE_SILENT_2, "Silent 2", 0},
+        {ToshibaSpecialModes::SPECIAL_MODE_SLEEP_CARE, "Sleep Care", 0},
+        {ToshibaSpecialModes::SPECIAL_MODE_FLOOR, "Floor", 0},
+        {ToshibaSpecialModes::SPECIAL_MODE_COMFORT, "Comfort", 0},
+    };
+    static constexpr RegisterValue POWER_SELECT_VALUES[] = {
+        {ToshibaPowerSelection::POWER_50, "50%", 0},
+        {ToshibaPowerSelection::POWER_75, "75%", 0},
+        {ToshibaPowerSelection::POWER_100, "100%", 0},
+    };
+    static constexpr RegisterValue IONIZER_VALUES[] = {
+        {ToshibaIonizer::IONIZER_ON, "ON", 1},
+        {ToshibaIonizer::IONIZER_OFF, "OFF", 0},
+    };
+
+    // one entry per register, the position in this table is the register's slot. an entry maps the raw value to
+    // its target entity, the handler only adds protocol side effects. status registers are decoded from their multi
+    // byte frames and have neither.
+    static constexpr RegisterDescriptor REGISTERS[] = {
+        // snapshot restore replays this order, power state and special mode go before the registers depending on them
+        {ToshibaCommand::POWER_STATE, "power state", &ToshibaController::handle_register_power_state, true,
+         {30, 300, 150, 1}, REGISTER_TARGET_NONE, POWER_STATE_VALUES},
+        {ToshibaCommand::SPECIAL_MODE, "special mode", &ToshibaController::handle_register_special_mode, true,
+         {60, 600, 150, 0}, REGISTER_TARGET_SELECT, SPECIAL_MODE_VALUES, &ToshibaController::special_mode_select_},
+        {ToshibaCommand::POWER_SELECT, "power select", &ToshibaController::handle_register_power_selection, true,
+         {60, 600, 150, 0}, REGISTER_TARGET_SELECT, POWER_SELECT_VALUES,
+         &ToshibaController::power_selection_select_},
+        {ToshibaCommand::FAN_MODE, "fan mode", &ToshibaController::handle_register_fan_mode, true, {30, 300, 150, 1},
+         REGISTER_TARGET_CLIMATE_FAN_MODE, FAN_MODE_VALUES},
+        {ToshibaCommand::SWING_MODE, "swing mode", &ToshibaController::handle_register_swing_mode, true,
+         {60, 600, 150, 0}, REGISTER_TARGET_CLIMATE_SWING_MODE, SWING_MODE_VALUES},
+        {ToshibaCommand::MODE, "mode", &ToshibaController::handle_register_mode, true, {30, 300, 150, 1},
+         REGISTER_TARGET_CLIMATE_MODE, MODE_VALUES},
+        // the setpoint is offset in EIGHT_DEGREES mode, its handler publishes it
+        {ToshibaCommand::TARGET_TEMPERATURE, "target temperature",
+         &ToshibaController::handle_register_target_temperature, true, {30, 300, 150, 1}},
+        {ToshibaCommand::ROOM_TEMPERATURE, "room temperature", &ToshibaController::handle_register_room_temperature,
+         false, {5, 60, 10, 2}, REGISTER_TARGET_SENSOR, {}, &ToshibaController::sensor_fcu_air_temp_},
+        {ToshibaCommand::OUTDOOR_TEMPERATURE, "outdoor temperature", nullptr, false, {10, 300, 10, 1},
+         REGISTER_TARGET_SIGNED_SENSOR, {}, &ToshibaController::sensor_outdoor_temperature_},
+        {ToshibaCommand::IONIZER, "ionizer state", nullptr, true, {60, 600, 150, 0}, REGISTER_TARGET_SWITCH,
+         IONIZER_VALUES, &ToshibaController::switch_ionizer_},
+        {ToshibaCommand::IDU_STATUS, "idu status", nullptr, false, {10, 150, 150, 2}},
+        {ToshibaCommand::ODU_STATUS, "odu status", nullptr, false, {10, 150, 150, 2}},
+    };
+    static constexpr uint8_t REGISTER_COUNT = sizeof(REGISTERS) / sizeof(REGISTERS[0]);
+    static constexpr RegisterIndex REGISTER_INDEX = build_register_index(REGISTERS);
+    static constexpr std::array<ReadFrame, REGISTER_COUNT> READ_FRAMES = build_read_frames(REGISTERS);
+
+    static uint8_t register_slot_(uint8_t command) {
+        if (command < REGISTER_COMMAND_BASE) {
+            return REGISTER_SLOT_NONE;
+        }
+        return REGISTER_INDEX.slots[command - REGISTER_COMMAND_BASE];
+    }
+
+    RegisterShadow register_shadow_[REGISTER_COUNT];
+    PollState poll_state_[REGISTER_COUNT];
+
+    // adapts the polling interval of a register to the volatility of its value
+    void update_poll_state_(uint8_t slot, bool changed, bool is_external_change) {
+        const PollProfile& profile = REGISTERS[slot].poll;
+        PollState& poll = poll_state_[slot];
+        if (changed) {
+            poll.interval_millis = std::max<uint32_t>(profile.min_interval * 1000, poll.interval_millis / 2);
+        } else if (!is_external_change) {
+            poll.interval_millis = std::min<uint32_t>(profile.max_interval * 1000, poll.interval_millis * 2);
+        }
+        if (is_external_change && poll.push_count++ == 0) {
+            ESP_LOGI(TAG, "IDU pushes %s, polling it only as fallback", REGISTERS[slot].name);
+        }
+        poll.deadline_millis = now_millis_() + poll.interval_millis;
+    }
+
+    void reset_poll_schedule_() {
+        for (uint8_t slot = 0; slot < REGISTER_COUNT; slot++) {
+            poll_state_[slot].interval_millis = REGISTERS[slot].poll.start_interval * 1000;
+            poll_state_[slot].deadline_millis = now_millis_() + poll_state_[slot].interval_millis;
+        }
+    }
+
+    void poll_registers_() {
+        // only refill once the previous requests are on the wire
+        if (!send_msg_queue_[TX_PRIORITY_POLLING].empty()) {
+            return;
+        }
+        uint32_t now = now_millis_();
+        for (int8_t priority = 2; priority >= 0; priority--) {
+            for (uint8_t slot = 0; slot < REGISTER_COUNT; slot++) {
+                PollState& poll = poll_state_[slot];
+                if (REGISTERS[slot].poll.priority != priority || (int32_t)(now - poll.deadline_millis) < 0) {
+                    continue;
+                }
+                ESP_LOGD(TAG, "polling %s (interval %d s)", REGISTERS[slot].name, poll.interval_millis / 1000);
+                request_read_register_(REGISTERS[slot].command);
+                // no response within the interval is treated like an unchanged value
+                poll.deadline_millis = now + poll.interval_millis;
+            }
+        }
+    }
+
+    // each value carries its command byte, a snapshot stored before REGISTERS was reordered still finds its handlers
+    struct RegisterSnapshot {
+        uint8_t commands[REGISTER_COUNT];
+        uint8_t values[REGISTER_COUNT];
+        uint16_t received_mask;
+    };
+    static_assert(REGISTER_COUNT <= 16, "received_mask holds one bit per register");
+
+    ESPPreferenceObject snapshot_pref_;
+    bool snapshot_dirty_ = false;
+    bool snapshot_saved_ = false;
+    uint32_t last_snapshot_save_millis_ = 0;
+
+    void restore_snapshot_() {
+        RegisterSnapshot snapshot{};
+        if (!snapshot_pref_.load(&snapshot)) {
+            ESP_LOGD(TAG, "no register snapshot stored");
+            return;
+        }
+
+        // map the stored entries onto the current slots first, the replay has to follow the order of REGISTERS
+        uint8_t values[REGISTER_COUNT] = {};
+        uint16_t stored_mask = 0;
+        for (uint8_t entry = 0; entry < REGISTER_COUNT; entry++) {
+            uint8_t slot = register_slot_(snapshot.commands[entry]);
+            if (!(snapshot.received_mask & (1 << entry)) || slot == REGISTER_SLOT_NONE) {
+                continue;
+            }
+            values[slot] = snapshot.values[entry];
+            stored_mask |= 1 << slot;
+        }
+
+        uint8_t restored = 0;
+        for (uint8_t slot = 0; slot < REGISTER_COUNT; slot++) {
+            if (!(stored_mask & (1 << slot)) || !REGISTERS[slot].has_value()) {
+                continue;
+            }
+            RegisterShadow& shadow = register_shadow_[slot];
+            shadow.value = values[slot];
+            shadow.received = true;
+            shadow.stale = true;
+            apply_register_(slot, shadow.value, false);
+            restored++;
+        }
+        // handlers may queue follow-up requests, those must not go out before the handshake. the writes among them
+        // are dropped with the queue, the registers' first polls replay the handlers once the IDU answers
+        clear_tx_queues_();
+        for (auto& write : pending_writes_) {
+            write.active = false;
+        }
+        ESP_LOGI(TAG, "restored %d registers from snapshot, stale until confirmed by the IDU", restored);
+    }
+
+    bool snapshot_registers_confirmed_() const {
+        for (uint8_t slot = 0; slot < REGISTER_COUNT; slot++) {
+            const RegisterShadow& shadow = register_shadow_[slot];
+            if (REGISTERS[slot].snapshot && (!shadow.received || shadow.stale)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // flash wear: only registers flagged for snapshots mark it dirty, and saves are throttled. the first save
+    // after boot goes out as soon as the IDU confirmed all of them.
+    void save_snapshot_() {
+        if (!snapshot_dirty_) {
+            return;
+        }
+        bool throttled = now_millis_() - last_snapshot_save_millis_ < SNAPSHOT_MIN_SAVE_INTERVAL;
+        if (throttled && (snapshot_saved_ || !snapshot_registers_confirmed_())) {
+            return;
+        }
+        RegisterSnapshot snapshot{};
+        for (uint8_t slot = 0; slot < REGISTER_COUNT; slot++) {
+            const RegisterShadow& shadow = register_shadow_[slot];
+            snapshot.commands[slot] = REGISTERS[slot].command;
+            if (shadow.received) {
+                snapshot.values[slot] = shadow.value;
+                snapshot.received_mask |= 1 << slot;
+            }
+        }
+        snapshot_pref_.save(&snapshot);
+        snapshot_dirty_ = false;
+        snapshot_saved_ = true;
+        last_snapshot_save_millis_ = now_millis_();
+        ESP_LOGD(TAG, "saved register snapshot");
+    }
+
+    uint32_t publish_heartbeat_millis_() const {
+        return this->config_settings_.publish_heartbeat_seconds * 1000;
+    }
+
+    uint32_t thermostat_min_interval_millis_() const {
+        return this->config_settings_.smart_thermostat_min_interval_seconds * 1000;
+    }
+
+    void publish_sensor_(ShadowedSensor& sensor, float value) {
+        sensor.publish_if_changed(value, now_millis_(), publish_heartbeat_millis_());
+    }
+
+    // forces the next received value of the register through its handler, used whenever our
+    // optimistic or derived state may no longer match the last received value
+    void invalidate_register_(ToshibaCommand command) {
+        uint8_t slot = register_slot_(command);
+        if (slot != REGISTER_SLOT_NONE) {
+            register_shadow_[slot].valid = false;
+        }
+    }
+
+    void handle_message(const uint8_t* frame, uint32_t frame_len) {
+        ESP_LOGD(TAG, "handle message: %s", format_hex_pretty(frame, frame_len).c_str());
+        if (frame[0] != 0x02 || frame[1] != 0x00 || frame[2] != 0x03) {
+            if (frame[3] == 0x80) {
+                ESP_LOGD(TAG, "received handshake reply: %s", format_hex_pretty(frame, frame_len).c_str());
+                this->handshake_reply_received_ = true;
+                note_tx_response_(TX_FRAME_RAW, 0);
+            } else if (frame[3] == 0x82) {
+                ESP_LOGD(TAG, "received post handshake reply: %s", format_hex_pretty(frame, frame_len).c_str());
+                this->post_handshake_reply_received_ = true;
+                note_tx_response_(TX_FRAME_RAW, 0);
+            } else {
+                ESP_LOGE(TAG, "invalid message header for: %s", format_hex_pretty(frame, frame_len).c_str());
+            }
+            return;
+        }
+
+        // parse single register message
+        if (frame_len == 15 || frame_len == 17) {
+            uint8_t command = frame[frame_len - 3];
+            uint8_t value = frame[frame_len - 2];
+            ESP_LOGI(TAG, "received register message: %s with value %d", format_hex_pretty(command).c_str(), value);
+            if (frame_len == 17) {
+                // reads and writes are both answered with the register value
+                note_tx_response_(TX_FRAME_READ, command);
+                note_tx_response_(TX_FRAME_WRITE, command);
+            }
+            uint8_t slot = register_slot_(command);
+            if (slot == REGISTER_SLOT_NONE || !REGISTERS[slot].has_value()) {
+                ESP_LOGE(TAG, "received unhandled register message: %s", format_hex_pretty(command).c_str());
+                return;
+            }
+            // responses to our polling are dropped while unchanged, pushed (external) changes are always handled
+            bool is_external_change = frame_len == 15;
+            RegisterShadow& shadow = register_shadow_[slot];
+            uint32_t now = now_millis_();
+            shadow.last_recv_millis = now;
+            update_poll_state_(slot, !shadow.received || shadow.value != value, is_external_change);
+            if (!confirm_pending_write_(slot, value, is_external_change)) {
+                // stale response to an earlier read or write, the optimistic state stays until the echo arrives
+                ESP_LOGD(TAG, "%s write pending, ignoring %s", REGISTERS[slot].name, format_hex_pretty(value).c_str());
+                shadow.value = value;
+                shadow.received = true;
+                return;
+            }
+            if (!is_external_change && shadow.valid && shadow.value == value &&
+                now - shadow.last_publish_millis < publish_heartbeat_millis_()) {
+                ESP_LOGV(TAG, "%s unchanged: %s", REGISTERS[slot].name, format_hex_pretty(value).c_str());
+                return;
+            }
+            if (REGISTERS[slot].snapshot && (!shadow.received || shadow.stale || shadow.value != value)) {
+                snapshot_dirty_ = true;
+            }
+            shadow.value = value;
+            shadow.valid = true;
+            shadow.received = true;
+            shadow.stale = false;
+            shadow.last_publish_millis = now;
+            apply_register_(slot, value, is_external_change);
+        } else if (frame_len == 22 || frame_len == 24) {
+            // pushed status frames are 22 bytes, requested ones carry two extra header bytes
+            const uint8_t* status = &frame[frame_len - STATUS_FRAME_COMMAND_TAIL];
+            bool is_external_change = frame_len == 22;
+            if (!is_external_change) {
+                note_tx_response_(TX_FRAME_READ, status[0]);
+            }
+            // only the status registers come in this size, anything else must not touch a register's shadow
+            if (status[0] != ToshibaCommand::ODU_STATUS && status[0] != ToshibaCommand::IDU_STATUS) {
+                ESP_LOGE(TAG, "received unhandled status message: %s", format_hex_pretty(status[0]).c_str());
+                return;
+            }
+            note_status_received_(status, is_external_change);
+            if (status[0] == ToshibaCommand::ODU_STATUS) {
+                handle_odu_status(OduStatusView{status}, is_external_change);
+            } else {
+                handle_idu_status(IduStatusView{status}, is_external_change);
+            }
+        } else {
+            ESP_LOGV(TAG, "Received unknown message with length: %d and value %s", frame_len,
+                     format_hex_pretty(frame, frame_len).c_str());
+            return;
+        }
+    }
+
+    // drops the current (invalid) frame candidate and slides forward to the next start byte
+    void resync_rx_() {
+        uint32_t skip = 1;
+        while (skip < recv_buf_len_ && recv_buf_[skip] != RX_FRAME_START) {
+            skip++;
+        }
+        ESP_LOGW(TAG, "rx resync, discarded %d bytes: %s", skip, format_hex_pretty(recv_buf_, skip).c_str());
+        consume_rx_(skip);
+        rx_resync_count_++;
+    }
+
+    void consume_rx_(uint32_t len) {
+        recv_buf_len_ -= len;
+        memmove(recv_buf_, &recv_buf_[len], recv_buf_len_);
+        recv_sum_ = 0;
+        recv_sum_len_ = 1;
+    }
+
+    // validates frame candidates at the start of recv_buf_ and dispatches every complete frame.
+    // returns when the buffer is empty or the candidate at the start is still incomplete.
+    void extract_rx_frames_() {
+        while (recv_buf_len_ > 0) {
+            if (recv_buf_[0] != RX_FRAME_START) {
+                resync_rx_();
+                continue;
+            }
+            if (recv_buf_len_ < 7) {
+                return;
+            }
+            uint32_t frame_len = recv_buf_[6] + 8;  // length + 6 + length byte + checksum
+            if (frame_len > RX_FRAME_MAX_LEN) {
+                resync_rx_();
+                continue;
+            }
+            uint32_t sum_end = std::min<uint32_t>(recv_buf_len_, frame_len - 1);
+            while (recv_sum_len_ < sum_end) {
+                recv_sum_ += recv_buf_[recv_sum_len_++];
+            }
+            if (recv_buf_len_ < frame_len) {
+                return;
+            }
+            // handshake replies were never checksum checked, keep taking them as they come
+            bool is_handshake_reply = (recv_buf_[1] != 0x00 || recv_buf_[2] != 0x03) &&
+                                      (recv_buf_[3] == 0x80 || recv_buf_[3] == 0x82);
+            if (uint8_t(-recv_sum_) != recv_buf_[frame_len - 1] && !is_handshake_reply) {
+                ESP_LOGE(TAG, "invalid checksum for: %s", format_hex_pretty(recv_buf_, frame_len).c_str());
+                resync_rx_();
+                continue;
+            }
+
+            ESP_LOGD(TAG, "received full message %d bytes", frame_len);
+            dispatch_rx_frame_(recv_buf_, frame_len);
+            consume_rx_(frame_len);
+        }
+    }
+
+    void dispatch_rx_frame_(const uint8_t* frame, uint32_t frame_len) {
+#ifdef USE_ESP32
+        if (rx_task_ != nullptr) {
+            if (!rx_task_frames_.push(frame, frame_len, now_millis_())) {
+                rx_task_drops_++;
+            }
+            return;
+        }
+#endif
+        rx_dispatch_histogram_.add(rx_poll_gap_millis_);
+        handle_message(frame, frame_len);
+    }
+
+    // assembles frames from the UART, runs in loop() or in the RX task
+    void read_uart_() {
+        uint32_t now = now_millis_();
+        rx_poll_gap_millis_ = now - last_rx_poll_millis_;
+        last_rx_poll_millis_ = now;
+
+        // pull everything the UART has buffered in as few read_array calls as possible,
+        // appending directly to recv_buf_ and extracting complete frames afterwards
+        int available = serial_->available();
+        while (available > 0) {
+            size_t chunk = std::min<size_t>(available, sizeof(recv_buf_) - recv_buf_len_);
+            if (!serial_->read_array(&recv_buf_[recv_buf_len_], chunk)) {
+                break;
+            }
+            last_recv_millis_ = now_millis_();
+            recv_buf_len_ += chunk;
+
+            extract_rx_frames_();
+
+            available = serial_->available();
+        }
+
+        // a candidate that stays incomplete while the line is idle was a false or truncated header,
+        // slide past it to recover any valid frame behind it
+        if (recv_buf_len_ > 0 && now_millis_() - last_recv_millis_ >= 200) {
+            ESP_LOGE(TAG, "rx timeout with %d bytes pending", uint32_t(recv_buf_len_));
+            while (recv_buf_len_ > 0) {
+                resync_rx_();
+                extract_rx_frames_();
+            }
+        }
+    }
+
+#ifdef USE_ESP32
+    // ESPHome's UART wrapper does not expose the driver's event queue, so the task polls it every tick
+    static void rx_task_main_(void* arg) {
+        auto* controller = static_cast<ToshibaController*>(arg);
+        while (true) {
+            controller->read_uart_();
+            vTaskDelay(1);
+        }
+    }
+
+    void start_rx_task_() {
+        // pinned to the last core, away from the Wi-Fi stack on dual core chips
+        if (xTaskCreatePinnedToCore(rx_task_main_, "toshiba_rx", RX_TASK_STACK_SIZE, this, RX_TASK_PRIORITY,
+                                    &rx_task_, portNUM_PROCESSORS - 1) != pdPASS) {
+            ESP_LOGE(TAG, "failed to start the RX task, reading the UART from loop()");
+            rx_task_ = nullptr;
         }
     }
 
-    void handle_register_power_selection(ToshibaPowerSelection value) {
-        switch (value) {
-            case ToshibaPowerSelection::POWER_50:
-                ESP_LOGI(TAG, "[REGISTER] received power select: %s", "50%");
-                power_selection_select_->publish_state("50%");
-                break;
-            case ToshibaPowerSelection::POWER_75:
-                ESP_LOGI(TAG, "[REGISTER] received power select: %s", "75%");
-                power_selection_select_->publish_state("75%");
-                break;
-            case ToshibaPowerSelection::POWER_100:
-                ESP_LOGI(TAG, "[REGISTER] received power select: %s", "100%");
-                power_selection_select_->publish_state("100%");
-                break;
-            default:
-                ESP_LOGE(TAG, "[REGISTER] received unknown power select: %s",
-                         format_hex_pretty((uint8_t)value).c_str());
-                break;
+    void dispatch_rx_task_frames_() {
+        for (auto* entry = rx_task_frames_.front(); entry != nullptr; entry = rx_task_frames_.front()) {
+            rx_dispatch_histogram_.add(now_millis_() - entry->recv_millis);
+            handle_message(entry->data, entry->len);
+            rx_task_frames_.pop();
         }
-        this->internal_power_selection_ = value;
     }
+#endif
 
-    void handle_register_room_temperature(uint8_t value) {
-        ESP_LOGI(TAG, "[REGISTER] received room temperature: %d", value);
-        this->internal_idu_room_temperature_ = value;
-        sensor_fcu_air_temp_.publish_state(value);
+    void process_uart_rx() {
+#ifdef USE_ESP32
+        if (rx_task_ != nullptr) {
+            dispatch_rx_task_frames_();
+        } else {
+            read_uart_();
+        }
+#else
+        read_uart_();
+#endif
 
-        if (this->switch_internal_thermistor_.state) {
-            this->current_temperature = (float)value;
-            this->publish_state();
+        if (rx_resync_count_ != sensor_rx_resyncs_.get_state()) {
+            sensor_rx_resyncs_.publish_state(rx_resync_count_);
         }
     }
 
-    void handle_register_outdoor_temperature(int8_t value) {
-        ESP_LOGI(TAG, "[REGISTER] received outdoor temperature: %d", value);
-        this->sensor_outdoor_temperature_.publish_state(value);
+    // per register counters of writes merged into a pending write and reads dropped as duplicates
+    uint32_t tx_write_merges_[REGISTER_COUNT] = {};
+    uint32_t tx_read_drops_[REGISTER_COUNT] = {};
+
+    void count_tx_merge_(uint32_t* counters, uint8_t command) {
+        uint8_t slot = register_slot_(command);
+        if (slot != REGISTER_SLOT_NONE) {
+            counters[slot]++;
+        }
     }
 
-    void handle_message() {
-        if (recv_buf_len_ > 30) {
-            ESP_LOGD(TAG, "handle message too long (%d)", recv_buf_len_);
-            return;
+    bool enqueue_frame_(TxPriority priority, const uint8_t* data, uint8_t len, TxFrameKind kind = TX_FRAME_RAW,
+                        uint8_t command = 0) {
+        auto& queue = this->send_msg_queue_[priority];
+        if (!queue.push(data, len, kind, command)) {
+            ESP_LOGW(TAG, "tx queue %d full, dropped frame %s (%d dropped total)", priority,
+                     format_hex_pretty(data, len).c_str(), queue.overflow_count());
+            return false;
         }
+        tx_queue_high_water_[priority] = std::max(tx_queue_high_water_[priority], queue.size());
+        return true;
+    }
 
-        ESP_LOGD(TAG, "handle message: %s", format_hex_pretty(recv_buf_, recv_buf_len_).c_str());
-        if (recv_buf_[0] != 0x02 || recv_buf_[1] != 0x00 || recv_buf_[2] != 0x03) {
-            if (recv_buf_[3] == 0x80) {
-                ESP_LOGD(TAG, "received handshake reply: %s", format_hex_pretty(recv_buf_, recv_buf_len_).c_str());
-            } else if (recv_buf_[3] == 0x82) {
-                ESP_LOGD(TAG, "received post handshake reply: %s", format_hex_pretty(recv_buf_, recv_buf_len_).c_str());
-            } else {
-                ESP_LOGE(TAG, "invalid message header for: %s", format_hex_pretty(recv_buf_, recv_buf_len_).c_str());
+    // looks up a queued read or write across all classes. a match in a lower class than requested is
+    // removed so the caller re-queues it with the higher priority.
+    TxFrame* find_pending_frame_(TxFrameKind kind, uint8_t command, TxPriority priority) {
+        for (uint8_t p = 0; p < TX_PRIORITY_COUNT; p++) {
+            if (p > priority) {
+                send_msg_queue_[p].remove(kind, command);
+                continue;
+            }
+            TxFrame* pending = send_msg_queue_[p].find(kind, command);
+            if (pending != nullptr) {
+                return pending;
             }
-            return;
         }
+        return nullptr;
+    }
+
+    PendingWrite pending_writes_[REGISTER_COUNT];
+    WriteStats write_stats_[REGISTER_COUNT];
 
-        uint8_t checksum = calc_checksum(recv_buf_, recv_buf_len_ - 1);
-        if (checksum != recv_buf_[recv_buf_len_ - 1]) {
-            ESP_LOGE(TAG, "invalid calculated checksum %s for: %s", format_hex_pretty(checksum).c_str(),
-                     format_hex_pretty(recv_buf_, recv_buf_len_).c_str());
+    void note_write_sent_(uint8_t command) {
+        uint8_t slot = register_slot_(command);
+        if (slot == REGISTER_SLOT_NONE || !pending_writes_[slot].active) {
             return;
         }
+        PendingWrite& write = pending_writes_[slot];
+        if (write.attempts == 0) {
+            write.first_sent_millis = now_millis_();
+        }
+        write.sent = true;
+        write.deadline_millis = now_millis_() + (WRITE_CONFIRM_TIMEOUT << write.attempts);
+        write.attempts++;
+    }
 
-        // parse single register message
-        if (recv_buf_len_ == 15 || recv_buf_len_ == 17) {
-            uint8_t command = recv_buf_[recv_buf_len_ - 3];
-            uint8_t value = recv_buf_[recv_buf_len_ - 2];
-            ESP_LOGI(TAG, "received register message: %s with value %d", format_hex_pretty(command).c_str(), value);
-            switch (command) {
-                case ToshibaCommand::MODE:
-                    ESP_LOGD(TAG, "received mode: %s", format_hex_pretty(value).c_str());
-                    handle_register_mode(static_cast<ToshibaMode>(value));
-                    break;
-                case ToshibaCommand::POWER_STATE:
-                    ESP_LOGD(TAG, "received power state: %s", format_hex_pretty(value).c_str());
-                    handle_register_power_state(static_cast<ToshibaState>(value));
-                    break;
-                case ToshibaCommand::TARGET_TEMPERATURE:
-                    ESP_LOGD(TAG, "received target temperature: %s", format_hex_pretty(value).c_str());
-                    handle_register_target_temperature(value, recv_buf_len_ == 15 ? true : false);
-                    break;
-                case ToshibaCommand::FAN_MODE:
-                    ESP_LOGD(TAG, "received fan mode: %s", format_hex_pretty(value).c_str());
-                    handle_register_fan_mode(static_cast<ToshibaFanMode>(value));
-                    break;
-                case ToshibaCommand::SWING_MODE:
-                    ESP_LOGD(TAG, "received swing mode: %s", format_hex_pretty(value).c_str());
-                    handle_register_swing_mode(static_cast<ToshibaSwingMode>(value));
-                    break;
-                case ToshibaCommand::SPECIAL_MODE:
-                    ESP_LOGD(TAG, "received special mode: %s", format_hex_pretty(value).c_str());
-                    handle_register_special_mode(static_cast<ToshibaSpecialModes>(value));
-                    break;
-                case ToshibaCommand::IONIZER:
-                    ESP_LOGD(TAG, "received ionizer state: %s", format_hex_pretty(value).c_str());
-                    handle_register_ionizer(static_cast<ToshibaIonizer>(value));
-                    break;
-                case ToshibaCommand::POWER_SELECT:
-                    ESP_LOGD(TAG, "received power select: %s", format_hex_pretty(value).c_str());
-                    handle_register_power_selection(static_cast<ToshibaPowerSelection>(value));
-                    break;
-                case ToshibaCommand::ROOM_TEMPERATURE:
-                    ESP_LOGD(TAG, "received room temperature: %s", format_hex_pretty(value).c_str());
-                    handle_register_room_temperature(value);
-                    break;
-                case ToshibaCommand::OUTDOOR_TEMPERATURE:
-                    ESP_LOGD(TAG, "received outdoor temperature: %s", format_hex_pretty(value).c_str());
-                    handle_register_outdoor_temperature((int8_t)value);
-                    break;
-                default:
-                    ESP_LOGE(TAG, "received unhandled register message: %s", format_hex_pretty(command).c_str());
-                    break;
-            }
-        } else if (recv_buf_len_ == 22) {
-            if (recv_buf_[12] == ToshibaCommand::ODU_STATUS) {
-                sensor_cdu_td_temp_.publish_state(static_cast<int8_t>(recv_buf_[13]));
-                sensor_cdu_ts_temp_.publish_state(static_cast<int8_t>(recv_buf_[14]));
-                sensor_cdu_te_temp_.publish_state(static_cast<int8_t>(recv_buf_[15]));
-                sensor_cdu_load_.publish_state(static_cast<float_t>(recv_buf_[16]) /
-                                               1.7f);  // toshiba names this register "cduHz", however it ranges from
-                                                       // 0-170 for different ODUs and is outside of the comp. range
-                sensor_cdu_iac_.publish_state(static_cast<uint8_t>(
-                    recv_buf_[19]));  // unsure, ranges from 0-68 and could be EEV actuation for this IDU
-                ESP_LOGI(
-                    TAG,
-                    "[REGISTERS_ODU] STATUS: cduTdTemp = %d, cduTsTemp = %d, cduTeTemp = %d, cduLoad = %d, cduIac = %d",
-                    (int32_t)sensor_cdu_td_temp_.get_state(), (int32_t)sensor_cdu_ts_temp_.get_state(),
-                    (int32_t)sensor_cdu_te_temp_.get_state(), (int32_t)sensor_cdu_load_.get_state(),
-                    (int32_t)sensor_cdu_iac_.get_state());
-            } else if (recv_buf_[12] == ToshibaCommand::IDU_STATUS) {
-                sensor_fcu_tc_temp_.publish_state(static_cast<int8_t>(recv_buf_[13]));
-                sensor_fcu_tcj_temp_.publish_state(static_cast<int8_t>(recv_buf_[14]));
-                sensor_fcu_fan_rpm_.publish_state(static_cast<uint8_t>(recv_buf_[15]));
-                ESP_LOGI(TAG, "[REGISTERS_IDU] STATUS: fcuTcTemp = %d, fcuTcjTemp = %d, fcuFanRpm = %d",
-                         (int32_t)sensor_fcu_tc_temp_.get_state(), (int32_t)sensor_fcu_tcj_temp_.get_state(),
-                         (int32_t)sensor_fcu_fan_rpm_.get_state());
-            }
-        } else if (recv_buf_len_ == 24) {
-            if (recv_buf_[14] == ToshibaCommand::ODU_STATUS) {
-                sensor_cdu_td_temp_.publish_state(static_cast<int8_t>(recv_buf_[15]));
-                sensor_cdu_ts_temp_.publish_state(static_cast<int8_t>(recv_buf_[16]));
-                sensor_cdu_te_temp_.publish_state(static_cast<int8_t>(recv_buf_[17]));
-                sensor_cdu_load_.publish_state(static_cast<float_t>(recv_buf_[18]) /
-                                               1.7f);  // toshiba names this register "cduHz", however it ranges from
-                                                       // 0-170 for different ODUs and is outside of the comp. range
-                sensor_cdu_iac_.publish_state(static_cast<uint8_t>(
-                    recv_buf_[21]));  // unsure, ranges from 0-68 and could be EEV actuation for this IDU
-                ESP_LOGI(TAG,
-                         "[REGISTERS_ODU_REQ] STATUS: cduTdTemp = %d, cduTsTemp = %d, cduTeTemp = %d, cduLoad = %d, "
-                         "cduIac = %d",
-                         (int32_t)sensor_cdu_td_temp_.get_state(), (int32_t)sensor_cdu_ts_temp_.get_state(),
-                         (int32_t)sensor_cdu_te_temp_.get_state(), (int32_t)sensor_cdu_load_.get_state(),
-                         (int32_t)sensor_cdu_iac_.get_state());
-            } else if (recv_buf_[14] == ToshibaCommand::IDU_STATUS) {
-                sensor_fcu_tc_temp_.publish_state(static_cast<int8_t>(recv_buf_[15]));
-                sensor_fcu_tcj_temp_.publish_state(static_cast<int8_t>(recv_buf_[16]));
-                sensor_fcu_fan_rpm_.publish_state(static_cast<uint8_t>(recv_buf_[17]));
-                ESP_LOGI(TAG, "[REGISTERS_IDU_REQ] STATUS: fcuTcTemp = %d, fcuTcjTemp = %d, fcuFanRpm = %d",
-                         (int32_t)sensor_fcu_tc_temp_.get_state(), (int32_t)sensor_fcu_tcj_temp_.get_state(),
-                         (int32_t)sensor_fcu_fan_rpm_.get_state());
+    // returns false while an unconfirmed write to the register should keep its optimistic state
+    bool confirm_pending_write_(uint8_t slot, uint8_t value, bool is_external_change) {
+        PendingWrite& write = pending_writes_[slot];
+        if (!write.active) {
+            return true;
+        }
+        if (value == write.value) {
+            WriteStats& stats = write_stats_[slot];
+            stats.confirmed++;
+            if (write.attempts > 0) {
+                uint32_t latency = now_millis_() - write.first_sent_millis;
+                stats.latency_total_millis += latency;
+                stats.latency_max_millis = std::max(stats.latency_max_millis, latency);
+                ESP_LOGD(TAG, "%s write confirmed after %d ms", REGISTERS[slot].name, latency);
             }
-        } else {
-            ESP_LOGV(TAG, "Received unknown message with length: %d and value %s", recv_buf_len_,
-                     format_hex_pretty(recv_buf_, recv_buf_len_).c_str());
-            return;
+            write.active = false;
+            return true;
         }
+        if (is_external_change) {
+            // changed on the IDU or its remote, that wins over our write
+            ESP_LOGW(TAG, "%s changed externally, dropping pending write", REGISTERS[slot].name);
+            write.active = false;
+            return true;
+        }
+        return false;
     }
 
-    void process_uart_rx() {
-        uint8_t cnt = 0;
-        while (serial_->available() > 0 && cnt < 32) {
-            if (!serial_->read_byte(&recv_buf_[recv_buf_len_])) {
-                break;
+    void process_pending_writes_() {
+        uint32_t now = now_millis_();
+        for (uint8_t slot = 0; slot < REGISTER_COUNT; slot++) {
+            PendingWrite& write = pending_writes_[slot];
+            if (!write.active || !write.sent || (int32_t)(now - write.deadline_millis) < 0) {
+                continue;
             }
-            last_recv_millis_ = millis();
-            recv_buf_len_++;
-
-            if (recv_buf_len_ > 255) {
-                ESP_LOGE(TAG, "rx buffer overflow");
-                this->recv_buf_len_ = 0;
+            ToshibaCommand command = REGISTERS[slot].command;
+            if (write.attempts < WRITE_MAX_ATTEMPTS) {
+                ESP_LOGW(TAG, "%s write not confirmed, retrying (attempt %d)", REGISTERS[slot].name,
+                         write.attempts + 1);
+                if (enqueue_write_frame_(static_cast<TxPriority>(write.priority), command, write.value)) {
+                    write_stats_[slot].retries++;
+                    write.sent = false;
+                } else {
+                    // queue full, try again once the deadline passed another time
+                    write.deadline_millis = now + WRITE_CONFIRM_TIMEOUT;
+                }
+                continue;
             }
 
-            if (recv_buf_len_ >= 7 && recv_buf_[6] + 8 == recv_buf_len_) {  // length + 6 + length byte + checksum
-                ESP_LOGD(TAG, "received full message %d bytes", recv_buf_len_);
-                handle_message();
-                recv_buf_len_ = 0;
+            ESP_LOGE(TAG, "%s write not confirmed after %d attempts, rolling back", REGISTERS[slot].name,
+                     write.attempts);
+            write_stats_[slot].failures++;
+            write.active = false;
+            RegisterShadow& shadow = register_shadow_[slot];
+            if (shadow.received && REGISTERS[slot].has_value()) {
+                shadow.valid = true;
+                shadow.last_publish_millis = now;
+                apply_register_(slot, shadow.value, false);
             }
-            cnt++;
+            // confirm the actual state either way
+            request_read_register_(command, TX_PRIORITY_PROTOCOL);
         }
+    }
+
+    bool enqueue_write_frame_(TxPriority priority, ToshibaCommand command, uint8_t value) {
+        WriteFrame frame = make_write_frame(command, value);
+        return this->enqueue_frame_(priority, frame.data(), frame.size(), TX_FRAME_WRITE, command);
+    }
 
-        if (recv_buf_len_ > 0 && millis() - last_recv_millis_ >= 200) {
-            ESP_LOGE(TAG, "discarded %d rx bytes due to timeout", recv_buf_len_);
-            recv_buf_len_ = 0;
+    void arm_pending_write_(ToshibaCommand command, uint8_t value, TxPriority priority) {
+        uint8_t slot = register_slot_(command);
+        if (slot == REGISTER_SLOT_NONE) {
+            return;
         }
+        PendingWrite& write = pending_writes_[slot];
+        write.sent = false;
+        write.value = value;
+        write.attempts = 0;
+        // an unconfirmed write keeps the highest class it was requested with
+        write.priority = write.active ? std::min<uint8_t>(write.priority, priority) : priority;
+        write.active = true;
     }
 
-    void request_write_register_(ToshibaCommand command, uint8_t value) {
-        std::vector<uint8_t> msg = {0x2,  0x0, 0x3, 0x10, 0x0, 0x0, 0x7, 0x1, 0x30, 0x1, 0x0, 0x2, uint8_t(command),
-                                    value};
+    void request_write_register_(ToshibaCommand command, uint8_t value, TxPriority priority = TX_PRIORITY_USER) {
+        invalidate_register_(command);
+
+        // a pending write to the same register keeps its queue position and takes the new value
+        TxFrame* pending = find_pending_frame_(TX_FRAME_WRITE, command, priority);
+        if (pending != nullptr) {
+            pending->data[13] = value;
+            pending->data[14] = write_frame_checksum(command, value);
+            count_tx_merge_(tx_write_merges_, command);
+            arm_pending_write_(command, value, priority);
+            ESP_LOGI(TAG, "merged write register %s with value %s into pending write",
+                     format_hex_pretty((uint8_t)command).c_str(), format_hex_pretty(value).c_str());
+            return;
+        }
 
-        msg.push_back(calc_checksum(&msg[0], msg.size()));
-        this->send_msg_queue_.push_back(msg);
+        // a write that never reaches the queue must not hold back the register's polled values
+        if (!enqueue_write_frame_(priority, command, value)) {
+            return;
+        }
+        arm_pending_write_(command, value, priority);
 
         ESP_LOGI(TAG, "requesting write register %s with value %s", format_hex_pretty((uint8_t)command).c_str(),
                  format_hex_pretty(value).c_str());
     }
 
-    void request_read_register_(ToshibaCommand command) {
-        std::vector<uint8_t> msg = {0x2, 0x0, 0x3, 0x10, 0x0, 0x0, 0x6, 0x1, 0x30, 0x1, 0x0, 0x1, uint8_t(command)};
-        msg.push_back(calc_checksum(&msg[0], msg.size()));
-        this->send_msg_queue_.push_back(msg);
+    void request_read_register_(ToshibaCommand command, TxPriority priority = TX_PRIORITY_POLLING) {
+        if (find_pending_frame_(TX_FRAME_READ, command, priority) != nullptr) {
+            count_tx_merge_(tx_read_drops_, command);
+            ESP_LOGD(TAG, "read register %s already pending", format_hex_pretty((uint8_t)command).c_str());
+            return;
+        }
+
+        uint8_t slot = register_slot_(command);
+        if (slot != REGISTER_SLOT_NONE) {
+            this->enqueue_frame_(priority, READ_FRAMES[slot].data(), READ_FRAMES[slot].size(), TX_FRAME_READ, command);
+        } else {
+            ReadFrame frame = make_read_frame(command);
+            this->enqueue_frame_(priority, frame.data(), frame.size(), TX_FRAME_READ, command);
+        }
 
         ESP_LOGI(TAG, "requesting read register %s", format_hex_pretty((uint8_t)command).c_str());
     }
@@ -725,7 +2488,73 @@ class ToshibaController final : public climate::Climate, public Component {
         supported_traits_.set_visual_target_temperature_step(0.5);
     }
 
-    void automatic_eight_degrees_switchover(uint8_t target_temperature) {
+    void send_handshake_() {
+        ESP_LOGD(TAG, "sending handshake (attempt %d)", this->handshake_attempts_ + 1);
+        if (this->handshake_attempts_ < UINT8_MAX) {
+            this->handshake_attempts_++;
+        }
+        this->handshake_reply_received_ = false;
+        for (const auto& msg : IDU_HANDSHAKE) {
+            this->enqueue_frame_(TX_PRIORITY_PROTOCOL, msg.data(), msg.size());
+        }
+        this->set_handshake_state_(HandshakeState::HANDSHAKE_SENT);
+    }
+
+    void send_post_handshake_() {
+        ESP_LOGD(TAG, "sending post handshake");
+        this->post_handshake_reply_received_ = false;
+        for (const auto& msg : IDU_POST_HANDSHAKE) {
+            this->enqueue_frame_(TX_PRIORITY_PROTOCOL, msg.data(), msg.size());
+        }
+        this->set_handshake_state_(HandshakeState::HANDSHAKE_POST_SENT);
+    }
+
+    // 3 s, 6 s, 12 s, ... up to HANDSHAKE_MAX_RETRY_INTERVAL
+    uint32_t handshake_retry_interval_() const {
+        uint8_t shift = std::min<uint8_t>(this->handshake_attempts_ - 1, 4);
+        return std::min(HANDSHAKE_REPLY_TIMEOUT << shift, HANDSHAKE_MAX_RETRY_INTERVAL);
+    }
+
+    void set_handshake_state_(HandshakeState state) {
+        this->handshake_state_ = state;
+        this->handshake_state_millis_ = now_millis_();
+    }
+
+    void process_handshake_() {
+        uint32_t elapsed = now_millis_() - this->handshake_state_millis_;
+        bool frames_sent = this->send_msg_queue_[TX_PRIORITY_PROTOCOL].empty();
+
+        switch (this->handshake_state_) {
+            case HandshakeState::HANDSHAKE_BOOT:
+                if (elapsed >= HANDSHAKE_BOOT_DELAY) {
+                    send_handshake_();
+                }
+                break;
+            case HandshakeState::HANDSHAKE_SENT:
+                if (frames_sent && this->handshake_reply_received_) {
+                    send_post_handshake_();
+                } else if (elapsed >= handshake_retry_interval_()) {
+                    ESP_LOGW(TAG, "no handshake reply after %d ms, retrying", elapsed);
+                    send_handshake_();
+                }
+                break;
+            case HandshakeState::HANDSHAKE_POST_SENT:
+                if ((frames_sent && this->post_handshake_reply_received_) || elapsed >= HANDSHAKE_REPLY_TIMEOUT) {
+                    if (!this->post_handshake_reply_received_) {
+                        ESP_LOGW(TAG, "no post handshake reply, requesting initial data anyway");
+                    }
+                    request_registers_();
+                    is_initialized_ = true;
+                    this->set_handshake_state_(HandshakeState::HANDSHAKE_DONE);
+                    ESP_LOGI(TAG, "initialized after %d ms", now_millis_());
+                }
+                break;
+            case HandshakeState::HANDSHAKE_DONE:
+                break;
+        }
+    }
+
+    void automatic_eight_degrees_switchover(uint8_t target_temperature, TxPriority priority = TX_PRIORITY_USER) {
         if (this->internal_power_state_ == ToshibaState::STATE_OFF) {
             ESP_LOGE(TAG, "IDU is powered off, ignoring special mode");
             return;
@@ -736,13 +2565,13 @@ class ToshibaController final : public climate::Climate, public Component {
                 ESP_LOGE(TAG,
                          "Special mode EIGHT_DEGREES is only required for 5°C-16°C heating, switching to STANDARD");
                 this->internal_special_mode_ = ToshibaSpecialModes::SPECIAL_MODE_STANDARD;
-                request_write_register_(ToshibaCommand::SPECIAL_MODE, this->internal_special_mode_);
+                request_write_register_(ToshibaCommand::SPECIAL_MODE, this->internal_special_mode_, priority);
                 this->special_mode_select_->publish_state("Standard");
             } else if (this->internal_special_mode_ != ToshibaSpecialModes::SPECIAL_MODE_EIGHT_DEGREES &&
                        target_temperature < 17) {
                 ESP_LOGE(TAG, "Special mode EIGHT_DEGREES is required for 5°C-16°C heating, enabling");
                 this->internal_special_mode_ = ToshibaSpecialModes::SPECIAL_MODE_EIGHT_DEGREES;
-                request_write_register_(ToshibaCommand::SPECIAL_MODE, this->internal_special_mode_);
+                request_write_register_(ToshibaCommand::SPECIAL_MODE, this->internal_special_mode_, priority);
                 this->special_mode_select_->publish_state("8 Degrees");
             }
 
@@ -750,7 +2579,7 @@ class ToshibaController final : public climate::Climate, public Component {
             if (this->internal_special_mode_ == ToshibaSpecialModes::SPECIAL_MODE_EIGHT_DEGREES) {
                 ESP_LOGE(TAG, "Special mode EIGHT_DEGREES is only available in heating mode, switching to STANDARD");
                 this->internal_special_mode_ = ToshibaSpecialModes::SPECIAL_MODE_STANDARD;
-                request_write_register_(ToshibaCommand::SPECIAL_MODE, this->internal_special_mode_);
+                request_write_register_(ToshibaCommand::SPECIAL_MODE, this->internal_special_mode_, priority);
                 this->special_mode_select_->publish_state("Standard");
             }
         }
@@ -779,6 +2608,21 @@ public:
         return config_settings_;
     }
 
+    // true once the handshake finished and the climate accepts control
+    bool is_initialized() const {
+        return is_initialized_;
+    }
+
+    // the gains the pid law currently runs with, configured or auto-tuned
+    const PidGains& pid_gains() const {
+        return pid_gains_;
+    }
+
+    // must be set before setup(), the clock has to outlive the controller
+    void set_clock(const ToshibaClock* clock) {
+        clock_ = clock;
+    }
+
     void setup() override {
         auto restore = this->restore_state_();
         if (restore.has_value()) {
@@ -788,7 +2632,7 @@ public:
             this->target_temperature = 20;
             this->set_fan_mode_(climate::CLIMATE_FAN_MEDIUM);
             this->swing_mode = climate::CLIMATE_SWING_OFF;
-            this->publish_state();
+            this->schedule_publish_();
         }
 
         switch_ionizer_.set_icon("mdi:pine-tree");
@@ -796,6 +2640,24 @@ public:
         switch_internal_thermistor_.set_icon("mdi:thermometer");
         switch_internal_thermistor_.restore_and_set_mode(esphome::switch_::SWITCH_RESTORE_DEFAULT_OFF);
 
+        ShadowedSensor* filtered_sensors[SENSOR_FILTERED_COUNT] = {
+            &sensor_outdoor_temperature_, &sensor_fcu_air_temp_, &sensor_fcu_setpoint_temp_, &sensor_fcu_tc_temp_,
+            &sensor_fcu_tcj_temp_,        &sensor_fcu_fan_rpm_,  &sensor_cdu_td_temp_,       &sensor_cdu_ts_temp_,
+            &sensor_cdu_te_temp_,         &sensor_cdu_load_,     &sensor_cdu_iac_,
+        };
+        for (uint8_t i = 0; i < SENSOR_FILTERED_COUNT; i++) {
+            filtered_sensors[i]->set_filter_settings(config_settings_.sensor_filters[i]);
+        }
+
+        if (temperature_sensor_ != nullptr) {
+            temperature_sensor_->add_on_state_callback([this](float state) {
+                if (state != thermostat_sensor_state_) {
+                    thermostat_sensor_state_ = state;
+                    note_thermostat_input_();
+                }
+            });
+        }
+
         ESP_LOGD(TAG, "setup before recv");
         while (serial_->available() > 0) {
             uint8_t b;
@@ -803,25 +2665,21 @@ public:
             ESP_LOGD(TAG, "read byte %s", format_hex_pretty(b).c_str());
         }
 
-        ESP_LOGD(TAG, "setup before handshake");
-        set_timeout("send_handshake", 10000, [this]() {
-            ESP_LOGD(TAG, "sending handshake");
-            for (const auto& msg : IDU_HANDSHAKE) {
-                this->send_msg_queue_.push_back(msg);
-            }
-            set_timeout("send_post_handshake", 3000, [this]() {
-                ESP_LOGD(TAG, "sending post handshake");
+        snapshot_pref_ = global_preferences->make_preference<RegisterSnapshot>(
+            this->get_object_id_hash() ^ fnv1_hash("toshiba_register_snapshot"), true);
+        restore_snapshot_();
+        load_pid_gains_();
 
-                for (const auto& msg : IDU_POST_HANDSHAKE) {
-                    this->send_msg_queue_.push_back(msg);
-                }
+        if (this->config_settings_.uart_rx_task) {
+#ifdef USE_ESP32
+            start_rx_task_();
+#else
+            ESP_LOGW(TAG, "uart_rx_task is only supported on ESP32, reading the UART from loop()");
+#endif
+        }
 
-                set_timeout("request_initial_data", 3000, [this]() {
-                    request_registers_(true);
-                    is_initialized_ = true;
-                });
-            });
-        });
+        ESP_LOGD(TAG, "setup before handshake");
+        this->handshake_state_millis_ = now_millis_();
     }
 
     climate::ClimateTraits traits() override {
@@ -831,8 +2689,9 @@ public:
     ///////////////////////////////////////////
     // CLIMATE ENTITY CONTROL HANDLING
     ///////////////////////////////////////////
-    void control_handle_mode(const climate::ClimateCall& call) {
-        this->mode = *call.get_mode();
+    void control_handle_mode(climate::ClimateMode mode) {
+        note_thermostat_input_();
+        this->mode = mode;
         if (this->mode == climate::CLIMATE_MODE_OFF) {
             this->request_write_register_(ToshibaCommand::POWER_STATE, ToshibaState::STATE_OFF);
             return;
@@ -864,8 +2723,9 @@ public:
         }
     }
 
-    void control_handle_target_temperature(const climate::ClimateCall& call) {
-        this->target_temperature = std::round(*call.get_target_temperature() * 2.0) / 2.0;  // 0.5 deg precision
+    void control_handle_target_temperature(float target_temperature) {
+        note_thermostat_input_();
+        this->target_temperature = std::round(target_temperature * 2.0) / 2.0;  // 0.5 deg precision
 
         if (this->target_temperature < std::min(MIN_TEMP_SETPOINT_HEATING, MIN_TEMP_SETPOINT_COOLING)) {
             this->target_temperature = std::min(MIN_TEMP_SETPOINT_HEATING, MIN_TEMP_SETPOINT_COOLING);
@@ -891,20 +2751,20 @@ public:
             } else {
                 this->request_write_register_(ToshibaCommand::TARGET_TEMPERATURE, this->internal_target_temperature_);
             }
-            sensor_fcu_setpoint_temp_.publish_state(this->internal_target_temperature_);
+            publish_sensor_(sensor_fcu_setpoint_temp_, this->internal_target_temperature_);
         } else {
             ESP_LOGD(TAG,
                      "internal thermistor is disabled, idu target temperature is updated by smart_thermostat_control");
         }
     }
 
-    void control_handle_fan_mode(const climate::ClimateCall& call) {
+    void control_handle_fan_mode(climate::ClimateFanMode fan_mode) {
         if (this->internal_power_state_ == ToshibaState::STATE_OFF) {
             ESP_LOGE(TAG, "IDU is powered off, ignoring fan mode control command");
             return;
         }
 
-        this->set_fan_mode_(*call.get_fan_mode());
+        this->set_fan_mode_(fan_mode);
 
         if (this->fan_mode == climate::CLIMATE_FAN_AUTO) {
             this->request_write_register_(ToshibaCommand::FAN_MODE, ToshibaFanMode::FAN_AUTO);
@@ -929,32 +2789,28 @@ public:
         ESP_LOGE(TAG, "received unknown fan mode: %s", this->fan_mode);
     }
 
-    void control_handle_custom_fan_mode(const climate::ClimateCall& call) {
+    // custom fan mode names are resolved in control(), the command carries the IDU fan mode
+    void control_handle_custom_fan_mode(ToshibaFanMode fan_mode) {
         if (this->internal_power_state_ == ToshibaState::STATE_OFF) {
             ESP_LOGE(TAG, "IDU is powered off, ignoring custom fan mode control command");
             return;
         }
 
-        this->set_custom_fan_mode_(*call.get_custom_fan_mode());
-
-        if (this->custom_fan_mode == CUSTOM_FAN_MODE_LOW_MEDIUM) {
-            this->request_write_register_(ToshibaCommand::FAN_MODE, ToshibaFanMode::FAN_LOW_MEDIUM);
-            return;
-        }
-        if (this->custom_fan_mode == CUSTOM_FAN_MODE_MEDIUM_HIGH) {
-            this->request_write_register_(ToshibaCommand::FAN_MODE, ToshibaFanMode::FAN_MEDIUM_HIGH);
-            return;
+        if (fan_mode == ToshibaFanMode::FAN_LOW_MEDIUM) {
+            this->set_custom_fan_mode_(CUSTOM_FAN_MODE_LOW_MEDIUM);
+        } else {
+            this->set_custom_fan_mode_(CUSTOM_FAN_MODE_MEDIUM_HIGH);
         }
-        ESP_LOGE(TAG, "received unknown custom fan mode: %s", this->custom_fan_mode);
+        this->request_write_register_(ToshibaCommand::FAN_MODE, fan_mode);
     }
 
-    void control_handle_swing_mode(const climate::ClimateCall& call) {
+    void control_handle_swing_mode(climate::ClimateSwingMode swing_mode) {
         if (this->internal_power_state_ == ToshibaState::STATE_OFF) {
             ESP_LOGE(TAG, "IDU is powered off, ignoring swing mode control command");
             return;
         }
 
-        this->swing_mode = *call.get_swing_mode();
+        this->swing_mode = swing_mode;
 
         if (this->swing_mode == climate::CLIMATE_SWING_OFF) {
             this->internal_swing_mode_ = ToshibaSwingMode::SWING_MODE_OFF;
@@ -980,45 +2836,50 @@ public:
         ESP_LOGE(TAG, "received unknown swing mode: %s", this->swing_mode);
     }
 
-    // Process changes from HA.
+    // Process changes from HA. Only queues the request, loop() applies it.
     void control(const climate::ClimateCall& call) override {
         ESP_LOGE(TAG, "climate entity control() called");
 
-        if (!is_initialized_) {
-            ESP_LOGE(TAG, "not initialized yet, ignoring control command");
-            return;
-        }
-
         if (call.get_mode().has_value()) {
-            this->control_handle_mode(call);
+            this->push_control_({CONTROL_MODE, *call.get_mode(), 0});
         }
         if (call.get_target_temperature().has_value()) {
-            this->control_handle_target_temperature(call);
+            this->push_control_({CONTROL_TARGET_TEMPERATURE, 0, *call.get_target_temperature()});
         }
         if (call.get_fan_mode().has_value()) {
-            this->control_handle_fan_mode(call);
-        }
-        if (call.get_custom_fan_mode().has_value()) {
-            this->control_handle_custom_fan_mode(call);
+            this->push_control_({CONTROL_FAN_MODE, *call.get_fan_mode(), 0});
         }
         if (call.get_custom_fan_mode().has_value()) {
-            this->control_handle_custom_fan_mode(call);
+            if (*call.get_custom_fan_mode() == CUSTOM_FAN_MODE_LOW_MEDIUM) {
+                this->push_control_({CONTROL_CUSTOM_FAN_MODE, ToshibaFanMode::FAN_LOW_MEDIUM, 0});
+            } else if (*call.get_custom_fan_mode() == CUSTOM_FAN_MODE_MEDIUM_HIGH) {
+                this->push_control_({CONTROL_CUSTOM_FAN_MODE, ToshibaFanMode::FAN_MEDIUM_HIGH, 0});
+            } else {
+                ESP_LOGE(TAG, "received unknown custom fan mode: %s", call.get_custom_fan_mode()->c_str());
+            }
         }
         if (call.get_swing_mode().has_value()) {
-            this->control_handle_swing_mode(call);
+            this->push_control_({CONTROL_SWING_MODE, *call.get_swing_mode(), 0});
         }
-        this->publish_state();
     }
 
     ///////////////////////////////////////////
     // CUSTOM ENTITY SELECTS
     ///////////////////////////////////////////
     void set_power_select(int power) {
-        if (!is_initialized_) {
-            ESP_LOGE(TAG, "not initialized yet, ignoring power select command");
-            return;
-        }
+        this->push_control_({CONTROL_POWER_SELECT, power, 0});
+    }
+
+    void set_swing_mode_select(int mode) {
+        this->push_control_({CONTROL_SWING_MODE_SELECT, mode, 0});
+    }
+
+    void set_special_mode_select(int mode) {
+        this->push_control_({CONTROL_SPECIAL_MODE_SELECT, mode, 0});
+    }
 
+private:
+    void apply_power_select_(int power) {
         // implement the index function as switch
         switch (power) {
             case 0:
@@ -1038,12 +2899,7 @@ public:
         this->request_write_register_(ToshibaCommand::POWER_SELECT, this->internal_power_selection_);
     }
 
-    void set_swing_mode_select(int mode) {
-        if (!is_initialized_) {
-            ESP_LOGE(TAG, "not initialized yet, ignoring swing mode select command");
-            return;
-        }
-
+    void apply_swing_mode_select_(int mode) {
         // implement the index function as switch
         switch (mode) {
             case 0:
@@ -1088,15 +2944,10 @@ public:
         }
 
         this->request_write_register_(ToshibaCommand::SWING_MODE, this->internal_swing_mode_);
-        this->publish_state();
+        this->schedule_publish_();
     }
 
-    void set_special_mode_select(int mode) {
-        if (!is_initialized_) {
-            ESP_LOGE(TAG, "not initialized yet, ignoring special mode select command");
-            return;
-        }
-
+    void apply_special_mode_select_(int mode) {
         ToshibaSpecialModes old_special_mode = this->internal_special_mode_;
 
         switch (mode) {
@@ -1151,11 +3002,11 @@ public:
             if (this->internal_target_temperature_ < 17) {
                 this->internal_target_temperature_ = 17;
                 this->request_write_register_(ToshibaCommand::TARGET_TEMPERATURE, this->internal_target_temperature_);
-                sensor_fcu_setpoint_temp_.publish_state(this->internal_target_temperature_);
+                publish_sensor_(sensor_fcu_setpoint_temp_, this->internal_target_temperature_);
 
                 if (switch_internal_thermistor_.state) {
                     this->target_temperature = this->internal_target_temperature_;
-                    this->publish_state();
+                    this->schedule_publish_();
                 }
             }
         }
@@ -1167,11 +3018,11 @@ public:
                 this->internal_target_temperature_ = 16;
                 this->request_write_register_(ToshibaCommand::TARGET_TEMPERATURE,
                                               this->internal_target_temperature_ + 16);
-                sensor_fcu_setpoint_temp_.publish_state(this->internal_target_temperature_);
+                publish_sensor_(sensor_fcu_setpoint_temp_, this->internal_target_temperature_);
 
                 if (switch_internal_thermistor_.state) {
                     this->target_temperature = this->internal_target_temperature_;
-                    this->publish_state();
+                    this->schedule_publish_();
                 }
             }
         }
@@ -1179,14 +3030,17 @@ public:
         this->request_write_register_(ToshibaCommand::SPECIAL_MODE, this->internal_special_mode_);
     }
 
+public:
     ///////////////////////////////////////////
     // SENSOR ENTITIES
     ///////////////////////////////////////////
     std::vector<sensor::Sensor*> get_sensors() {
         return {
-            &sensor_outdoor_temperature_, &sensor_fcu_air_temp_, &sensor_fcu_setpoint_temp_, &sensor_fcu_tc_temp_,
-            &sensor_fcu_tcj_temp_,        &sensor_fcu_fan_rpm_,  &sensor_cdu_td_temp_,       &sensor_cdu_ts_temp_,
-            &sensor_cdu_te_temp_,         &sensor_cdu_load_,     &sensor_cdu_iac_,
+            &sensor_outdoor_temperature_,   &sensor_fcu_air_temp_,          &sensor_fcu_setpoint_temp_,
+            &sensor_fcu_tc_temp_,           &sensor_fcu_tcj_temp_,          &sensor_fcu_fan_rpm_,
+            &sensor_cdu_td_temp_,           &sensor_cdu_ts_temp_,           &sensor_cdu_te_temp_,
+            &sensor_cdu_load_,              &sensor_cdu_iac_,               &sensor_rx_resyncs_,
+            &sensor_thermal_time_constant_, &sensor_thermal_setpoint_gain_, &sensor_thermal_outdoor_gain_,
         };
     }
 
@@ -1202,15 +3056,179 @@ public:
 
     void set_internal_thermistor_switch(bool state) {
         ESP_LOGD(TAG, "set_internal_thermistor_switch %d", state);
+        this->push_control_({CONTROL_INTERNAL_THERMISTOR, state, 0});
     }
 
     void set_ionizer_switch(bool state) {
         ESP_LOGD(TAG, "set_ionizer_switch %d", state);
-        if (!is_initialized_) {
-            ESP_LOGE(TAG, "not initialized yet, ignoring ionizer switch command");
+        this->push_control_({CONTROL_IONIZER, state, 0});
+    }
+
+    ///////////////////////////////////////////
+    // BUTTONS
+    ///////////////////////////////////////////
+    void start_pid_autotune() {
+        ESP_LOGD(TAG, "start_pid_autotune");
+        this->push_control_({CONTROL_PID_AUTOTUNE, 0, 0});
+    }
+
+    void reset_pid_gains() {
+        ESP_LOGD(TAG, "reset_pid_gains");
+        this->push_control_({CONTROL_PID_RESET_GAINS, 0, 0});
+    }
+
+private:
+    CommandRing<ControlCommand, CONTROL_QUEUE_CAPACITY> control_queue_;
+    uint32_t control_count_ = 0;
+
+    void push_control_(const ControlCommand& command) {
+        if (!control_queue_.push(command)) {
+            ESP_LOGE(TAG, "control queue full, dropping command %d", command.type);
+        }
+    }
+
+    // the single place where requests from HA, selects and switches touch the protocol state
+    void process_control_queue_() {
+        ControlCommand command;
+        while (control_queue_.pop(command)) {
+            control_count_++;
+            if (!is_initialized_ && command.type != CONTROL_INTERNAL_THERMISTOR &&
+                command.type != CONTROL_PID_RESET_GAINS) {
+                ESP_LOGE(TAG, "not initialized yet, ignoring control command %d", command.type);
+                continue;
+            }
+            switch (command.type) {
+                case CONTROL_MODE:
+                    this->control_handle_mode(static_cast<climate::ClimateMode>(command.value));
+                    this->schedule_publish_();
+                    break;
+                case CONTROL_TARGET_TEMPERATURE:
+                    this->control_handle_target_temperature(command.temperature);
+                    this->schedule_publish_();
+                    break;
+                case CONTROL_FAN_MODE:
+                    this->control_handle_fan_mode(static_cast<climate::ClimateFanMode>(command.value));
+                    this->schedule_publish_();
+                    break;
+                case CONTROL_CUSTOM_FAN_MODE:
+                    this->control_handle_custom_fan_mode(static_cast<ToshibaFanMode>(command.value));
+                    this->schedule_publish_();
+                    break;
+                case CONTROL_SWING_MODE:
+                    this->control_handle_swing_mode(static_cast<climate::ClimateSwingMode>(command.value));
+                    this->schedule_publish_();
+                    break;
+                case CONTROL_POWER_SELECT:
+                    this->apply_power_select_(command.value);
+                    break;
+                case CONTROL_SWING_MODE_SELECT:
+                    this->apply_swing_mode_select_(command.value);
+                    break;
+                case CONTROL_SPECIAL_MODE_SELECT:
+                    this->apply_special_mode_select_(command.value);
+                    break;
+                case CONTROL_IONIZER:
+                    this->apply_ionizer_switch_(command.value != 0);
+                    break;
+                case CONTROL_INTERNAL_THERMISTOR:
+                    if (command.value != 0 && pid_autotuner_.running()) {
+                        pid_autotuner_.abort();
+                        ESP_LOGW(TAG, "pid auto-tuning aborted, the internal thermistor took over");
+                    }
+                    note_thermostat_input_();
+                    // room and target temperature only reach the climate entity while the internal thermistor is used
+                    invalidate_register_(ToshibaCommand::ROOM_TEMPERATURE);
+                    invalidate_register_(ToshibaCommand::TARGET_TEMPERATURE);
+                    break;
+                case CONTROL_PID_AUTOTUNE:
+                    this->start_pid_autotune_();
+                    break;
+                case CONTROL_PID_RESET_GAINS:
+                    this->reset_pid_gains_();
+                    break;
+            }
+        }
+    }
+
+    void start_pid_autotune_() {
+        if (!this->config_settings_.smart_thermostat_pid) {
+            ESP_LOGW(TAG, "pid auto-tuning needs smart_thermostat_pid");
+            return;
+        }
+        if (switch_internal_thermistor_.state || !thermostat_mode_active_()) {
+            ESP_LOGW(TAG, "pid auto-tuning needs the external sensor and heat, cool or heat_cool mode");
+            return;
+        }
+        pid_autotuner_.start(this->target_temperature, thermostat_room_temperature_(), now_millis_());
+        // evaluate on the next loop() so the relay takes over right away
+        thermostat_inputs_changed_ = true;
+        last_external_temperature_sensor_control_millis_ = now_millis_() - thermostat_min_interval_millis_();
+        ESP_LOGI(TAG, "pid auto-tuning started");
+    }
+
+    PidGains configured_pid_gains_() const {
+        return {this->config_settings_.pid_kp, this->config_settings_.pid_ki, this->config_settings_.pid_kd};
+    }
+
+    void load_pid_gains_() {
+        pid_gains_pref_ = global_preferences->make_preference<StoredPidGains>(
+            this->get_object_id_hash() ^ fnv1_hash("toshiba_pid_gains"), true);
+        pid_gains_ = configured_pid_gains_();
+        StoredPidGains stored{};
+        if (!pid_gains_pref_.load(&stored) || !stored.valid) {
+            return;
+        }
+        // gains edited in the YAML since the last tuning win over the tuned ones
+        if (stored.configured.kp != pid_gains_.kp || stored.configured.ki != pid_gains_.ki ||
+            stored.configured.kd != pid_gains_.kd) {
+            ESP_LOGI(TAG, "configured pid gains changed, ignoring the auto-tuned gains");
             return;
         }
+        pid_gains_ = stored.tuned;
+        ESP_LOGI(TAG, "restored pid gains kp %.3f ki %.5f kd %.1f", pid_gains_.kp, pid_gains_.ki, pid_gains_.kd);
+    }
+
+    void save_pid_gains_(bool valid) {
+        StoredPidGains stored{pid_gains_, configured_pid_gains_(), valid};
+        pid_gains_pref_.save(&stored);
+    }
+
+    void reset_pid_gains_() {
+        if (pid_autotuner_.running()) {
+            pid_autotuner_.abort();
+            ESP_LOGW(TAG, "pid auto-tuning aborted by the gain reset");
+        }
+        pid_gains_ = configured_pid_gains_();
+        pid_state_ = PidState{};
+        save_pid_gains_(false);
+        ESP_LOGI(TAG, "pid gains reset to kp %.3f ki %.5f kd %.1f", pid_gains_.kp, pid_gains_.ki, pid_gains_.kd);
+    }
+
+    // relay step of the auto-tuner, stores the gains once the limit cycle has been measured
+    uint8_t pid_autotune_step_(const PidInput& in, float& raw_setpoint) {
+        float relay_offset = 0;
+        switch (pid_autotuner_.update(in.target, in.room, now_millis_(), relay_offset)) {
+            case RelayAutoTuner::AUTOTUNE_DONE:
+                pid_gains_ = pid_autotuner_.gains();
+                save_pid_gains_(true);
+                pid_state_ = PidState{};
+                ESP_LOGI(TAG, "pid auto-tuning done: Tu %.0f s, amplitude %.2f, Ku %.2f -> kp %.3f ki %.5f kd %.1f",
+                         pid_autotuner_.period_seconds(), pid_autotuner_.amplitude(), pid_autotuner_.ultimate_gain(),
+                         pid_gains_.kp, pid_gains_.ki, pid_gains_.kd);
+                return smart_thermostat_pid(in, pid_gains_, pid_state_, now_millis_(), raw_setpoint);
+            case RelayAutoTuner::AUTOTUNE_FAILED:
+                pid_state_ = PidState{};
+                ESP_LOGW(TAG, "pid auto-tuning failed after %d cycles (amplitude %.2f), keeping the previous gains",
+                         pid_autotuner_.cycles(), pid_autotuner_.amplitude());
+                return smart_thermostat_pid(in, pid_gains_, pid_state_, now_millis_(), raw_setpoint);
+            default:
+                break;
+        }
+        raw_setpoint = in.target + in.median_error + relay_offset;
+        return std::max<long>(in.min_setpoint, std::min<long>(in.max_setpoint, lroundf(raw_setpoint)));
+    }
 
+    void apply_ionizer_switch_(bool state) {
         if (state) {
             this->request_write_register_(ToshibaCommand::IONIZER, ToshibaIonizer::IONIZER_ON);
         } else {
@@ -1218,45 +3236,52 @@ public:
         }
     }
 
-private:
-    void request_registers_(bool full) {
-        this->request_read_register_(ToshibaCommand::ROOM_TEMPERATURE);
-        this->request_read_register_(ToshibaCommand::OUTDOOR_TEMPERATURE);
-
-        if (full) {
-            this->request_read_register_(ToshibaCommand::POWER_STATE);
-            this->request_read_register_(ToshibaCommand::MODE);
-            this->request_read_register_(ToshibaCommand::TARGET_TEMPERATURE);
-            this->request_read_register_(ToshibaCommand::FAN_MODE);
-            this->request_read_register_(ToshibaCommand::SWING_MODE);
-            this->request_read_register_(ToshibaCommand::SPECIAL_MODE);
-            this->request_read_register_(ToshibaCommand::IONIZER);
-            this->request_read_register_(ToshibaCommand::POWER_SELECT);
-            this->request_read_register_(ToshibaCommand::ODU_STATUS);
-            this->request_read_register_(ToshibaCommand::IDU_STATUS);
-        }
-    }
-
-    std::deque<std::pair<double, long>> offset_history_;  // <error, time>
-    long last_fcu_fan_off_millis_ = 0;
-    double temperature_boost_mode = 0;
-    int thermal_runaway_fix = 0;
-    uint8_t thermostat_rounding_mode = 0;
-
-    void smart_thermostat_control() {
-        if (!is_initialized_) {
-            return;
+    void request_registers_() {
+        for (const auto& reg : REGISTERS) {
+            this->request_read_register_(reg.command, TX_PRIORITY_PROTOCOL);
         }
-        if (millis() - last_external_temperature_sensor_control_millis_ < 30000) {
-            return;
-        }
-        last_external_temperature_sensor_control_millis_ = millis();
+        reset_poll_schedule_();
+    }
 
-        if (switch_internal_thermistor_.state) {
-            return;
+    // at most 32 samples accumulate in 15 minutes at one per 30 s tick
+    RollingMedianWindow<ThermostatScalar, 64> offset_history_;
+    uint32_t last_fcu_fan_off_millis_ = 0;
+    double temperature_boost_mode = 0;
+    ThermostatLawState thermostat_state_;
+
+    // auto-tuned gains along with the configured gains they replaced
+    struct StoredPidGains {
+        PidGains tuned;
+        PidGains configured;
+        bool valid;
+    };
+
+    PidGains pid_gains_{};
+    PidState pid_state_;
+    RelayAutoTuner pid_autotuner_;
+    ESPPreferenceObject pid_gains_pref_;
+
+    ThermalModel thermal_model_;
+    climate::ClimateMode thermal_model_mode_ = climate::CLIMATE_MODE_OFF;
+    uint32_t last_thermal_sample_millis_ = 0;
+    bool thermal_sample_valid_ = false;
+    float thermal_sample_room_ = 0;
+    float thermal_sample_setpoint_ = 0;
+    float thermal_sample_outdoor_ = 0;
+
+    uint32_t last_offset_sample_millis_ = 0;
+    bool thermostat_inputs_changed_ = false;
+    bool thermostat_fan_running_ = false;
+    float thermostat_sensor_state_ = NAN;
+
+    void note_thermostat_input_() {
+        if (this->config_settings_.smart_thermostat_event_driven) {
+            thermostat_inputs_changed_ = true;
         }
+    }
 
-        double room_temp = 20;
+    float thermostat_room_temperature_() {
+        float room_temp = 20;
 
         if (temperature_sensor_ != nullptr) {
             room_temp = temperature_sensor_->get_state();
@@ -1271,130 +3296,217 @@ private:
         if (room_temp > 35) {
             room_temp = 35;
         }
+        return room_temp;
+    }
 
-        if (this->mode != climate::CLIMATE_MODE_HEAT && this->mode != climate::CLIMATE_MODE_COOL &&
-            this->mode != climate::CLIMATE_MODE_HEAT_COOL) {
-            this->current_temperature = room_temp;
-            this->publish_state();
-            return;
-        }
+    bool thermostat_mode_active_() const {
+        return this->mode == climate::CLIMATE_MODE_HEAT || this->mode == climate::CLIMATE_MODE_COOL ||
+               this->mode == climate::CLIMATE_MODE_HEAT_COOL;
+    }
 
+    // adds the IDU thermistor offset to the history, returns true if the median moved
+    bool sample_thermostat_offset_() {
+        using M = ThermostatMath<ThermostatScalar>;
         if (sensor_fcu_fan_rpm_.get_state() <= 0) {
-            last_fcu_fan_off_millis_ = millis();
+            last_fcu_fan_off_millis_ = now_millis_();
         }
 
+        ThermostatScalar median_before = offset_history_.empty() ? 0 : offset_history_.median();
+
         // if the fan is running (for at least one minute), add the current offset to the offset history
-        if (sensor_fcu_fan_rpm_.get_state() > 0 && millis() - last_fcu_fan_off_millis_ > 60000) {
-            offset_history_.emplace_back((double)internal_idu_room_temperature_ - room_temp, millis());
+        if (sensor_fcu_fan_rpm_.get_state() > 0 && now_millis_() - last_fcu_fan_off_millis_ > 60000) {
+            offset_history_.push(M::from(internal_idu_room_temperature_) - M::from(thermostat_room_temperature_()),
+                                 now_millis_());
         }
 
         // delete elements older than 15 minutes but only if at least 10 are left in the offset_history
-        long current_time = millis();
-        while (offset_history_.size() > 10 &&
-               current_time - offset_history_.front().second > 900000) {  // 900000 millis = 15 minutes
-            offset_history_.pop_front();
-        }
-
-        // select the median value of offset history but keep the elements in offset_history
-        double median_error = 0;
-        double average_error = 0;
-        if (!offset_history_.empty()) {
-            std::vector<double> errors;
-            errors.reserve(offset_history_.size());
+        offset_history_.expire(now_millis_(), 900000, 10);  // 900000 millis = 15 minutes
 
-            for (const auto& item : offset_history_) {
-                errors.push_back(item.first);  // add only the error of each pair
-                average_error += item.first;
-            }
+        return !offset_history_.empty() && offset_history_.median() != median_before;
+    }
 
-            average_error /= offset_history_.size();
-            size_t n = errors.size() / 2;
-            std::nth_element(errors.begin(), errors.begin() + n, errors.end());
-            median_error = errors.size() % 2 == 0 ? (errors[n - 1] + errors[n]) / 2.0 : errors[n];
+    // feeds the thermal model one transition per THERMAL_MODEL_INTERVAL while the smart thermostat is in charge
+    void sample_thermal_model_() {
+        uint32_t now = now_millis_();
+        uint32_t elapsed = now - last_thermal_sample_millis_;
+        if (elapsed < THERMAL_MODEL_INTERVAL) {
+            return;
         }
+        last_thermal_sample_millis_ = now;
 
-        // calculate target_error and target_setpoint
-        double target_error = this->target_temperature - room_temp;
-        double target_setpoint =
-            this->target_temperature + median_error + target_error * this->config_settings_.smart_thermostat_multiplier;
-
-        // occasionally, the devices suffer from thermal runaway. it will not perform the requested operation
-        // even if the error is significant and the setpoint is adjusted. 
-        // below we fix this by setting a plausible, but significant change in target temperature.
-        // this can increase compressor cycles, but keeps the error in check.
-        if (this->config_settings_.smart_thermostat_runaway_protection) {
-            if (target_error > std::max(0.25, 1.0/this->config_settings_.smart_thermostat_multiplier)) {
-                thermal_runaway_fix = 1;
-            }
-            else if (target_error < -std::max(0.25, 1.0/this->config_settings_.smart_thermostat_multiplier)) {
-                thermal_runaway_fix = -1;
-            }
-            else if (std::abs(target_error) < 0.15) {
-                thermal_runaway_fix = 0;
+        float outdoor = sensor_outdoor_temperature_.get_state();
+        if (!thermostat_mode_active_() || std::isnan(outdoor)) {
+            thermal_sample_valid_ = false;
+            return;
+        }
+        // heating and cooling are different plants, the fit of one says nothing about the other
+        if (this->mode != thermal_model_mode_) {
+            thermal_model_.reset();
+            thermal_model_mode_ = this->mode;
+            thermal_sample_valid_ = false;
+        }
+
+        float room = thermostat_room_temperature_();
+        // a gap (internal thermistor, slow loop) breaks the fixed sample period the model is defined on
+        if (thermal_sample_valid_ && elapsed < 2 * THERMAL_MODEL_INTERVAL) {
+            thermal_model_.update(thermal_sample_room_, thermal_sample_setpoint_, thermal_sample_outdoor_, room);
+            if (thermal_model_.valid()) {
+                sensor_thermal_time_constant_.publish_state(thermal_model_.time_constant() / 60);
+                sensor_thermal_setpoint_gain_.publish_state(thermal_model_.setpoint_gain());
+                sensor_thermal_outdoor_gain_.publish_state(thermal_model_.outdoor_gain());
             }
+        }
+        thermal_sample_valid_ = true;
+        thermal_sample_room_ = room;
+        thermal_sample_setpoint_ = this->internal_target_temperature_;
+        thermal_sample_outdoor_ = outdoor;
+    }
 
-            if (thermal_runaway_fix == 1) {
-                target_setpoint = std::max((double)this->target_temperature, target_setpoint);
-                target_setpoint = std::max((double)internal_idu_room_temperature_, target_setpoint);
-                target_setpoint = std::max((double)this->target_temperature+median_error, target_setpoint);
-                target_setpoint += 3.0;
-            } else if (thermal_runaway_fix == -1) {
-                target_setpoint = std::min((double)this->target_temperature, target_setpoint);
-                target_setpoint = std::min((double)internal_idu_room_temperature_, target_setpoint);
-                target_setpoint = std::min((double)this->target_temperature+median_error, target_setpoint);
-                target_setpoint -= 3.0;
+    // pulls the setpoint back towards the feed forward while the model predicts the room to cross the target by
+    // more than the margin within the prediction horizon
+    uint8_t prevent_overshoot_(float room, uint8_t setpoint, float feed_forward, uint8_t min_setpoint) {
+        float outdoor = sensor_outdoor_temperature_.get_state();
+        if (!thermal_model_.valid() || std::isnan(outdoor)) {
+            return setpoint;
+        }
+        float target = this->target_temperature;
+        float corrected = setpoint;
+        if (room <= target) {
+            float limit = thermal_model_.setpoint_for(room, outdoor, THERMAL_PREDICTION_HORIZON,
+                                                      target + THERMAL_OVERSHOOT_MARGIN);
+            limit = std::max(std::floor(limit), std::round(feed_forward));
+            corrected = std::min<float>(setpoint, limit);
+        } else {
+            float limit = thermal_model_.setpoint_for(room, outdoor, THERMAL_PREDICTION_HORIZON,
+                                                      target - THERMAL_OVERSHOOT_MARGIN);
+            limit = std::min(std::ceil(limit), std::round(feed_forward));
+            corrected = std::max<float>(setpoint, limit);
+        }
+        // the feed forward may lie outside of the setpoint range of the mode, clamp before narrowing to uint8_t
+        uint8_t clamped = std::max<float>(min_setpoint, std::min<float>(MAX_TEMP_SETPOINT, corrected));
+        if (clamped != setpoint) {
+            ESP_LOGD(TAG, "smart_thermostat: predicted overshoot, setpoint %d -> %d (tau %.0f min)", setpoint, clamped,
+                     thermal_model_.time_constant() / 60);
+        }
+        return clamped;
+    }
 
-            }
+    void smart_thermostat_control() {
+        if (!is_initialized_) {
+            return;
         }
-
-        // to account for the low 1°C precision of the device, we need to either ceil or floor the target.
-        // we switch only at extrema which ideally leads to a slow, but constant osciallation around the target
-        if (target_error > 0.2) {
-            thermostat_rounding_mode = 1;
-        } else if (target_error < -0.2) {
-            thermostat_rounding_mode = -1;
+        if (switch_internal_thermistor_.state) {
+            return;
         }
-        uint8_t target_setpoint_int = std::floor(std::min(255.0, std::max(0.0, target_setpoint)));
 
-        if (thermostat_rounding_mode == 1) {
-            target_setpoint_int = std::ceil(std::min(255.0, std::max(0.0, target_setpoint)));
+        sample_thermal_model_();
+
+        uint32_t now = now_millis_();
+        if (now - last_offset_sample_millis_ >= THERMOSTAT_SAMPLE_INTERVAL) {
+            last_offset_sample_millis_ = now;
+            if (!this->config_settings_.smart_thermostat_event_driven) {
+                // fixed tick: evaluate on every sample
+                thermostat_inputs_changed_ = true;
+            }
+            if (thermostat_mode_active_() && sample_thermostat_offset_()) {
+                note_thermostat_input_();
+            }
         }
 
+        uint32_t since_evaluation = now - last_external_temperature_sensor_control_millis_;
+        if (thermostat_inputs_changed_ ? since_evaluation < thermostat_min_interval_millis_()
+                                       : since_evaluation < THERMOSTAT_FALLBACK_INTERVAL) {
+            return;
+        }
+        thermostat_inputs_changed_ = false;
+        last_external_temperature_sensor_control_millis_ = now;
+        evaluate_smart_thermostat_();
+    }
 
-        uint8_t min_setpoint =
-            this->mode == climate::CLIMATE_MODE_HEAT ? MIN_TEMP_SETPOINT_HEATING : MIN_TEMP_SETPOINT_COOLING;
+    void evaluate_smart_thermostat_() {
+        float room_temp = thermostat_room_temperature_();
 
-        uint8_t max_setpoint = MAX_TEMP_SETPOINT;
+        if (!thermostat_mode_active_()) {
+            if (pid_autotuner_.running()) {
+                pid_autotuner_.abort();
+                ESP_LOGW(TAG, "pid auto-tuning aborted, the mode changed");
+            }
+            pid_state_ = PidState{};
+            this->current_temperature = room_temp;
+            this->schedule_publish_();
+            return;
+        }
 
-        target_setpoint_int = std::max(min_setpoint, std::min(max_setpoint, target_setpoint_int));
+        using M = ThermostatMath<ThermostatScalar>;
+        ThermostatScalar median_error = 0;
+        ThermostatScalar average_error = 0;
+        if (!offset_history_.empty()) {
+            median_error = offset_history_.median();
+            average_error = offset_history_.mean();
+        }
+
+        uint8_t min_setpoint = this->mode == climate::CLIMATE_MODE_HEAT ? (uint8_t)MIN_TEMP_SETPOINT_HEATING
+                                                                         : (uint8_t)MIN_TEMP_SETPOINT_COOLING;
+        float target_setpoint;
+        uint8_t target_setpoint_int;
+        if (this->config_settings_.smart_thermostat_pid) {
+            PidInput input{this->target_temperature, room_temp, M::to_float(median_error), min_setpoint,
+                           MAX_TEMP_SETPOINT};
+            target_setpoint_int = pid_autotuner_.running()
+                                      ? pid_autotune_step_(input, target_setpoint)
+                                      : smart_thermostat_pid(input, pid_gains_, pid_state_, now_millis_(),
+                                                             target_setpoint);
+        } else {
+            ThermostatLawInput<ThermostatScalar> input{
+                M::from(this->target_temperature),
+                M::from(room_temp),
+                M::from(internal_idu_room_temperature_),
+                median_error,
+                M::from(this->config_settings_.smart_thermostat_multiplier),
+                this->config_settings_.smart_thermostat_runaway_protection,
+                min_setpoint,
+                MAX_TEMP_SETPOINT,
+            };
+            ThermostatScalar law_setpoint;
+            target_setpoint_int = smart_thermostat_law(input, thermostat_state_, law_setpoint);
+            target_setpoint = M::to_float(law_setpoint);
+        }
+        if (this->config_settings_.smart_thermostat_predictive && !pid_autotuner_.running()) {
+            target_setpoint_int = prevent_overshoot_(
+                room_temp, target_setpoint_int, this->target_temperature + M::to_float(median_error), min_setpoint);
+        }
+        target_setpoint_int = std::max(min_setpoint, std::min<uint8_t>(MAX_TEMP_SETPOINT, target_setpoint_int));
 
         // update the internal target temperature if the rounded setpoint is different
         if (target_setpoint_int != this->internal_target_temperature_) {
             this->internal_target_temperature_ = target_setpoint_int;
-            automatic_eight_degrees_switchover(this->internal_target_temperature_);
+            automatic_eight_degrees_switchover(this->internal_target_temperature_, TX_PRIORITY_PROTOCOL);
 
             if (this->internal_target_temperature_ < 17) {
                 this->request_write_register_(ToshibaCommand::TARGET_TEMPERATURE,
-                                              this->internal_target_temperature_ + 16);
+                                              this->internal_target_temperature_ + 16, TX_PRIORITY_PROTOCOL);
             } else {
-                this->request_write_register_(ToshibaCommand::TARGET_TEMPERATURE, this->internal_target_temperature_);
+                this->request_write_register_(ToshibaCommand::TARGET_TEMPERATURE, this->internal_target_temperature_,
+                                              TX_PRIORITY_PROTOCOL);
             }
-            sensor_fcu_setpoint_temp_.publish_state(this->internal_target_temperature_);
+            publish_sensor_(sensor_fcu_setpoint_temp_, this->internal_target_temperature_);
             ESP_LOGD(TAG,
                      "smart_thermostat: set internal_target_temperature_ for target %.2f (current: %.2f) to %d (raw: "
                      "%.2f) (fcuAirTemp: %.2f) with median_error %.2f (avg_error: %.2f) and thermal_runaway_fix %d",
                      this->target_temperature, room_temp, target_setpoint_int, target_setpoint,
-                     this->sensor_fcu_air_temp_.get_state(), median_error, average_error, thermal_runaway_fix);
+                     this->sensor_fcu_air_temp_.get_state(), M::to_float(median_error), M::to_float(average_error),
+                     thermostat_state_.runaway_fix);
         } else {
             ESP_LOGD(TAG,
                      "smart_thermostat: set internal_target_temperature_ for target %.2f (current: %.2f) to %d (raw: "
                      "%.2f) (fcuAirTemp: %.2f) with median_error %.2f (avg_error: %.2f) and thermal_runaway_fix %d [no change]",
                      this->target_temperature, room_temp, target_setpoint_int, target_setpoint,
-                     this->sensor_fcu_air_temp_.get_state(), median_error, average_error, thermal_runaway_fix);
+                     this->sensor_fcu_air_temp_.get_state(), M::to_float(median_error), M::to_float(average_error),
+                     thermostat_state_.runaway_fix);
         }
 
         this->current_temperature = room_temp;
-        this->publish_state();
+        this->schedule_publish_();
     }
 
     void loop() {
@@ -1404,22 +3516,21 @@ private:
         loop_cnt_++;
 
         process_uart_rx();
+        process_control_queue_();
+        process_handshake_();
         process_uart_tx();
 
         smart_thermostat_control();  // will continously monitor but only apply changes if "internal thermostat" is
                                      // disabled
 
-        if (is_initialized_ && millis() > 30000) {
-            if (millis() - last_partial_register_request_millis_ > 10000) {
-                ESP_LOGD(TAG, "requesting partial registers");
-                last_partial_register_request_millis_ = millis();
-                request_registers_(false);
-            } else if (millis() - last_full_register_request_millis_ > 150000) {
-                ESP_LOGD(TAG, "requesting full registers");
-                last_full_register_request_millis_ = millis();
-                request_registers_(true);
-            }
+        if (is_initialized_) {
+            process_pending_writes_();
+            poll_registers_();
         }
+
+        flush_publish_();
+        save_snapshot_();
+        log_statistics_();
     }
 };
 
@@ -0,0 +1,75 @@
+// A controller wired to the emulated IDU and the simulated clock. Include once per test, the controller header has
+// no include guard.
+#pragma once
+
+#include "harness.h"
+#include "toshiba-controller.h"
+
+namespace toshiba_test {
+
+class HostClock final : public ToshibaClock {
+public:
+    uint32_t millis() const override {
+        return sim_clock.now;
+    }
+};
+
+// typical loop() period of an ESPHome node
+static const uint32_t LOOP_PERIOD = 16;
+
+class ControllerFixture {
+public:
+    FakeUart uart;
+    EmulatedIdu idu{&uart};
+    sensor::Sensor room_sensor;
+    template_::TemplateSelect special_mode_select;
+    template_::TemplateSelect swing_mode_select;
+    template_::TemplateSelect power_select;
+    HostClock clock;
+    ToshibaController controller{&uart, &room_sensor, &special_mode_select, &swing_mode_select, &power_select};
+
+    ControllerFixture() {
+        sim_clock.now = 0;
+        controller.set_clock(&clock);
+    }
+
+    void setup() {
+        controller.setup();
+    }
+
+    // one loop() pass, then time moves on and due IDU replies arrive
+    void step(uint32_t period = LOOP_PERIOD) {
+        // loop() is private in the controller, ESPHome calls it through Component as well
+        static_cast<Component&>(controller).loop();
+        sim_clock.now += period;
+        idu.deliver(sim_clock.now);
+    }
+
+    void run_for(uint32_t millis, uint32_t period = LOOP_PERIOD) {
+        uint32_t end = sim_clock.now + millis;
+        while ((int32_t)(end - sim_clock.now) > 0) {
+            step(period);
+        }
+    }
+
+    // runs until the predicate holds, returns false on timeout
+    template <typename Predicate>
+    bool run_until(Predicate predicate, uint32_t timeout, uint32_t period = LOOP_PERIOD) {
+        uint32_t end = sim_clock.now + timeout;
+        while (!predicate()) {
+            if ((int32_t)(end - sim_clock.now) <= 0) {
+                return false;
+            }
+            step(period);
+        }
+        return true;
+    }
+
+    bool initialize(uint32_t timeout = 60000) {
+        setup();
+        return run_until([this] { return controller.is_initialized(); }, timeout) &&
+               run_until([this] { return controller.mode != climate::CLIMATE_MODE_OFF; }, 5000);
+    }
+};
+
+}  // namespace toshiba_test
@@ -0,0 +1,301 @@
+#include "harness.h"
+
+#include <cstdarg>
+#include <cstdlib>
+
+namespace esphome {
+
+uint32_t millis() {
+    return toshiba_test::sim_clock.now;
+}
+
+void log_printf(int level, const char* tag, const char* format, ...) {
+    if (!toshiba_test::log_enabled()) {
+        return;
+    }
+    static const char LEVELS[] = "?EWIDV";
+    std::printf("%9u [%c][%s] ", toshiba_test::sim_clock.now, LEVELS[level < 6 ? level : 0], tag);
+    va_list args;
+    va_start(args, format);
+    std::vprintf(format, args);
+    va_end(args);
+    std::printf("\n");
+}
+
+std::string format_hex_pretty(const uint8_t* data, size_t length) {
+    std::string result;
+    char byte[4];
+    for (size_t i = 0; i < length; i++) {
+        std::snprintf(byte, sizeof(byte), i + 1 < length ? "%02X." : "%02X", data[i]);
+        result += byte;
+    }
+    return result;
+}
+
+std::string format_hex_pretty(const std::vector<uint8_t>& data) {
+    return format_hex_pretty(data.data(), data.size());
+}
+
+std::string format_hex_pretty(uint8_t value) {
+    return format_hex_pretty(&value, 1);
+}
+
+uint32_t fnv1_hash(const std::string& str) {
+    uint32_t hash = 2166136261UL;
+    for (char c : str) {
+        hash *= 16777619UL;
+        hash ^= static_cast<uint8_t>(c);
+    }
+    return hash;
+}
+
+namespace {
+
+struct FlashSlot {
+    bool used;
+    uint32_t key;
+    size_t size;
+    uint8_t data[ESPPreferenceObject::MAX_SIZE];
+};
+
+FlashSlot flash_slots[8];
+uint32_t flash_saves = 0;
+
+FlashSlot* find_flash_slot(uint32_t key) {
+    for (auto& slot : flash_slots) {
+        if (slot.used && slot.key == key) {
+            return &slot;
+        }
+    }
+    return nullptr;
+}
+
+}  // namespace
+
+bool ESPPreferenceObject::save_bytes_(const uint8_t* data, size_t size) {
+    FlashSlot* slot = find_flash_slot(key_);
+    for (auto& free_slot : flash_slots) {
+        if (slot != nullptr) {
+            break;
+        }
+        if (!free_slot.used) {
+            slot = &free_slot;
+        }
+    }
+    if (slot == nullptr) {
+        return false;
+    }
+    slot->used = true;
+    slot->key = key_;
+    slot->size = size;
+    memcpy(slot->data, data, size);
+    flash_saves++;
+    return true;
+}
+
+bool ESPPreferenceObject::load_bytes_(uint8_t* data, size_t size) {
+    FlashSlot* slot = find_flash_slot(key_);
+    // like on the device, a stored record of a different size does not load
+    if (slot == nullptr || slot->size != size) {
+        return false;
+    }
+    memcpy(data, slot->data, size);
+    return true;
+}
+
+void ESPPreferences::erase_all() {
+    for (auto& slot : flash_slots) {
+        slot.used = false;
+    }
+    flash_saves = 0;
+}
+
+uint32_t ESPPreferences::save_count() {
+    return flash_saves;
+}
+
+ESPPreferences* global_preferences = new ESPPreferences();
+
+}  // namespace esphome
+
+namespace toshiba_test {
+
+uint32_t check_failures = 0;
+SimClock sim_clock;
+
+int finish(const char* name) {
+    if (check_failures == 0) {
+        std::printf("%s: all checks passed\n", name);
+        return 0;
+    }
+    std::printf("%s: %u checks failed\n", name, check_failures);
+    return 1;
+}
+
+bool log_enabled() {
+    static const bool enabled = std::getenv("TOSHIBA_TEST_LOG") != nullptr;
+    return enabled;
+}
+
+uint8_t frame_checksum(const uint8_t* frame, uint8_t length) {
+    uint8_t sum = 0;
+    for (uint8_t i = 1; i + 1 < length; i++) {
+        sum += frame[i];
+    }
+    return static_cast<uint8_t>(-sum);
+}
+
+bool FakeUart::read_array(uint8_t* data, size_t length) {
+    rx_calls++;
+    if (length > rx_size_) {
+        return false;
+    }
+    for (size_t i = 0; i < length; i++) {
+        data[i] = rx_[rx_head_];
+        rx_head_ = (rx_head_ + 1) % RX_CAPACITY;
+    }
+    rx_size_ -= length;
+    return true;
+}
+
+void FakeUart::write_array(const uint8_t* data, size_t length) {
+    tx_frames++;
+    if (sink_ != nullptr) {
+        sink_->on_tx(data, length);
+    }
+}
+
+bool FakeUart::inject(const uint8_t* data, size_t length) {
+    if (rx_size_ + length > RX_CAPACITY) {
+        return false;
+    }
+    for (size_t i = 0; i < length; i++) {
+        rx_[(rx_head_ + rx_size_) % RX_CAPACITY] = data[i];
+        rx_size_++;
+    }
+    return true;
+}
+
+EmulatedIdu::EmulatedIdu(FakeUart* uart) : uart_(uart) {
+    uart->set_sink(this);
+    registers[0x80] = 0x30;  // POWER_STATE on
+    registers[0x87] = 0x64;  // POWER_SELECT 100%
+    registers[0xA0] = 0x41;  // FAN_MODE auto
+    registers[0xA3] = 0x31;  // SWING_MODE off
+    registers[0xB0] = 0x43;  // MODE heat
+    registers[0xB3] = 21;    // TARGET_TEMPERATURE
+    registers[0xBB] = 20;    // ROOM_TEMPERATURE
+    registers[0xBE] = 5;     // OUTDOOR_TEMPERATURE
+    registers[0xC7] = 0x10;  // IONIZER off
+    registers[0xF7] = 0x00;  // SPECIAL_MODE standard
+}
+
+namespace {
+
+// register and status frames share the header, requested ones carry two extra bytes before the command
+uint8_t build_frame(uint8_t* frame, uint8_t command, const uint8_t* payload, uint8_t payload_length, bool requested) {
+    static const uint8_t HEADER[] = {0x02, 0x00, 0x03, 0x90, 0x00, 0x00, 0x00, 0x01, 0x30, 0x01, 0x00, 0x02};
+    uint8_t length = 0;
+    for (uint8_t byte : HEADER) {
+        frame[length++] = byte;
+    }
+    if (requested) {
+        frame[length++] = 0x00;
+        frame[length++] = 0x00;
+    }
+    frame[length++] = command;
+    for (uint8_t i = 0; i < payload_length; i++) {
+        frame[length++] = payload[i];
+    }
+    length++;
+    frame[6] = length - 8;
+    frame[length - 1] = frame_checksum(frame, length);
+    return length;
+}
+
+}  // namespace
+
+uint8_t EmulatedIdu::make_register_frame(uint8_t* frame, uint8_t command, uint8_t value, bool requested) {
+    return build_frame(frame, command, &value, 1, requested);
+}
+
+uint8_t EmulatedIdu::make_status_frame(uint8_t* frame, uint8_t command, bool requested) const {
+    if (command == 0xE5) {
+        const uint8_t payload[] = {(uint8_t)td, (uint8_t)ts, (uint8_t)te, load, 0x00, 0x00, iac, 0x00};
+        return build_frame(frame, command, payload, sizeof(payload), requested);
+    }
+    const uint8_t payload[] = {(uint8_t)tc, (uint8_t)tcj, fan_rpm, 0x00, 0x00, 0x00, 0x00, 0x00};
+    return build_frame(frame, command, payload, sizeof(payload), requested);
+}
+
+void EmulatedIdu::on_tx(const uint8_t* data, size_t length) {
+    if (sim_clock.now < boot_millis || length < 8 || data[0] != 0x02) {
+        return;
+    }
+    uint8_t frame[FRAME_MAX];
+    if (data[2] != 0x03) {
+        // handshake, the IDU acknowledges every frame of both phases
+        handshake_frames++;
+        uint8_t reply[] = {0x02, 0x00, 0x02, (uint8_t)(data[2] == 0x02 ? 0x82 : 0x80), 0x00, 0x00, 0x00, 0x00};
+        reply[7] = handshake_reply_checksum != 0 ? handshake_reply_checksum : frame_checksum(reply, sizeof(reply));
+        reply_(reply, sizeof(reply));
+        return;
+    }
+    if (length < 14) {
+        return;
+    }
+    uint8_t command = data[12];
+    if (data[11] == 0x01) {
+        reads++;
+        reads_of[command]++;
+        if (command == 0xE4 || command == 0xE5) {
+            reply_(frame, make_status_frame(frame, command, true));
+        } else {
+            reply_(frame, make_register_frame(frame, command, registers[command], true));
+        }
+    } else if (data[11] == 0x02 && length >= 15) {
+        writes++;
+        last_write_command = command;
+        registers[command] = data[13];
+        if (drop_write_echoes > 0) {
+            drop_write_echoes--;
+            return;
+        }
+        reply_(frame, make_register_frame(frame, command, registers[command], true));
+    }
+}
+
+void EmulatedIdu::reply_(const uint8_t* frame, uint8_t length) {
+    if (pending_count_ == MAX_PENDING) {
+        return;
+    }
+    Pending& pending = pending_[pending_count_++];
+    pending.due = sim_clock.now + turnaround_millis;
+    pending.length = length;
+    memcpy(pending.data, frame, length);
+}
+
+void EmulatedIdu::deliver(uint32_t now) {
+    uint8_t kept = 0;
+    for (uint8_t i = 0; i < pending_count_; i++) {
+        if ((int32_t)(now - pending_[i].due) >= 0) {
+            uart_->inject(pending_[i].data, pending_[i].length);
+        } else {
+            pending_[kept++] = pending_[i];
+        }
+    }
+    pending_count_ = kept;
+}
+
+void EmulatedIdu::push_register(uint8_t command, uint8_t value) {
+    registers[command] = value;
+    uint8_t frame[FRAME_MAX];
+    uart_->inject(frame, make_register_frame(frame, command, value, false));
+}
+
+void EmulatedIdu::push_status(uint8_t command) {
+    uint8_t frame[FRAME_MAX];
+    uart_->inject(frame, make_status_frame(frame, command, false));
+}
+
+}  // namespace toshiba_test
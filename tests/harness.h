@@ -0,0 +1,142 @@
+// Host test support: checks, a simulated clock, a fake UART and an emulated indoor unit (IDU).
+// Nothing in here allocates once constructed, so the allocation tests can run the controller against it.
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+
+#include "esphome.h"
+
+namespace toshiba_test {
+
+extern uint32_t check_failures;
+
+#define CHECK(condition)                                                             \
+    do {                                                                             \
+        if (!(condition)) {                                                          \
+            std::printf("%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+            toshiba_test::check_failures++;                                          \
+        }                                                                            \
+    } while (false)
+
+#define CHECK_EQ(actual, expected)                                                                      \
+    do {                                                                                                \
+        auto actual_ = (actual);                                                                        \
+        auto expected_ = (expected);                                                                    \
+        if (!(actual_ == expected_)) {                                                                  \
+            std::printf("%s:%d: CHECK_EQ failed: %s == %s (%g vs %g)\n", __FILE__, __LINE__, #actual,     \
+                        #expected, static_cast<double>(actual_), static_cast<double>(expected_));       \
+            toshiba_test::check_failures++;                                                             \
+        }                                                                                               \
+    } while (false)
+
+// prints the summary and returns the process exit code
+int finish(const char* name);
+
+// millis() of the stubbed ESPHome core, also handed to the controller through set_clock()
+class SimClock {
+public:
+    uint32_t now = 0;
+};
+extern SimClock sim_clock;
+
+// controller logs are printed when TOSHIBA_TEST_LOG is set in the environment
+bool log_enabled();
+
+// Sum of bytes 1..n-2, negated. Written independently of the controller so both sides check each other.
+uint8_t frame_checksum(const uint8_t* frame, uint8_t length);
+
+// Bytes the controller sends end up in the IDU, bytes the IDU answers wait in a fixed RX buffer.
+class FakeUart final : public uart::UARTComponent {
+public:
+    static const uint16_t RX_CAPACITY = 2048;
+
+    class Sink {
+    public:
+        virtual void on_tx(const uint8_t* data, size_t length) = 0;
+    };
+
+    void set_sink(Sink* sink) {
+        sink_ = sink;
+    }
+
+    int available() override {
+        return rx_size_;
+    }
+    bool read_array(uint8_t* data, size_t length) override;
+    void write_array(const uint8_t* data, size_t length) override;
+
+    // host side: bytes that arrive on the ESP's RX line
+    bool inject(const uint8_t* data, size_t length);
+
+    uint32_t rx_calls = 0;  // read_array calls, one per read_byte
+    uint32_t tx_frames = 0;
+
+private:
+    Sink* sink_ = nullptr;
+    uint8_t rx_[RX_CAPACITY] = {};
+    uint16_t rx_head_ = 0;
+    uint16_t rx_size_ = 0;
+};
+
+// Register level emulation of an indoor unit: answers the handshake, reads and writes after a turnaround, and
+// can push register and status frames like the IDU does after an IR remote change.
+class EmulatedIdu final : public FakeUart::Sink {
+public:
+    static const uint8_t MAX_PENDING = 32;
+    static const uint8_t FRAME_MAX = 32;
+
+    explicit EmulatedIdu(FakeUart* uart);
+
+    // frames sent before this time are ignored, emulates a unit that powers up with the ESP
+    uint32_t boot_millis = 0;
+    uint32_t turnaround_millis = 30;
+    // the next this many write echoes are swallowed, emulates a lost frame
+    uint8_t drop_write_echoes = 0;
+    // handshake replies carry this instead of their checksum, 0 keeps the valid one
+    uint8_t handshake_reply_checksum = 0;
+
+    uint8_t registers[256] = {};
+    int8_t tc = 30;
+    int8_t tcj = 35;
+    uint8_t fan_rpm = 0;
+    int8_t td = 60;
+    int8_t ts = 5;
+    int8_t te = 2;
+    uint8_t load = 40;
+    uint8_t iac = 5;
+
+    uint32_t handshake_frames = 0;
+    uint32_t reads = 0;
+    uint32_t reads_of[256] = {};
+    uint32_t writes = 0;
+    uint32_t last_write_command = 0;
+
+    void on_tx(const uint8_t* data, size_t length) override;
+
+    // delivers replies that are due, call after advancing the clock
+    void deliver(uint32_t now);
+
+    void push_register(uint8_t command, uint8_t value);
+    void push_status(uint8_t command);
+
+    // builds a 17 byte (requested) or 15 byte (pushed) register frame
+    static uint8_t make_register_frame(uint8_t* frame, uint8_t command, uint8_t value, bool requested);
+    // builds a 24 byte (requested) or 22 byte (pushed) status frame
+    uint8_t make_status_frame(uint8_t* frame, uint8_t command, bool requested) const;
+
+private:
+    struct Pending {
+        uint32_t due;
+        uint8_t length;
+        uint8_t data[FRAME_MAX];
+    };
+
+    FakeUart* uart_;
+    Pending pending_[MAX_PENDING];
+    uint8_t pending_count_ = 0;
+
+    void reply_(const uint8_t* frame, uint8_t length);
+};
+
+}  // namespace toshiba_test
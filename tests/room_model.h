@@ -0,0 +1,45 @@
+// First-order room heated through the emulated IDU, shared by the closed loop simulations.
+#pragma once
+
+#include <cmath>
+
+#include "controller_fixture.h"
+
+namespace toshiba_test {
+
+// heated through the IDU's own thermostat, which reads the room 2 °C warm while its fan runs
+struct Room {
+    double temperature = 17;
+    double outdoor = 5;
+    double time_constant = 4 * 3600;
+    double idu_offset = 2;
+
+    // returns the heating power in 0..3
+    double step(uint8_t idu_setpoint, double seconds) {
+        double power = std::max(0.0, std::min(3.0, idu_setpoint - (temperature + idu_offset)));
+        temperature += seconds * ((outdoor - temperature) + power * 15) / time_constant;
+        return power;
+    }
+};
+
+// advances the room by one model step and reports it to the IDU and the HA sensor like the real devices do
+inline void drive_room(ControllerFixture& fixture, Room& room, double seconds) {
+    double power = room.step(fixture.idu.registers[ToshibaCommand::TARGET_TEMPERATURE], seconds);
+
+    uint8_t fan_rpm = power > 0 ? 60 : 0;
+    if (fan_rpm != fixture.idu.fan_rpm) {
+        fixture.idu.fan_rpm = fan_rpm;
+        fixture.idu.push_status(ToshibaCommand::IDU_STATUS);
+    }
+    uint8_t idu_room = std::lround(room.temperature + room.idu_offset);
+    if (idu_room != fixture.idu.registers[ToshibaCommand::ROOM_TEMPERATURE]) {
+        fixture.idu.push_register(ToshibaCommand::ROOM_TEMPERATURE, idu_room);
+    }
+    // the HA sensor reports in 0.1 °C steps and only on changes
+    float reported = std::round(room.temperature * 10) / 10;
+    if (reported != fixture.room_sensor.get_state()) {
+        fixture.room_sensor.publish_state(reported);
+    }
+}
+
+}  // namespace toshiba_test
@@ -0,0 +1,356 @@
+// Minimal stand-in for the ESPHome API used by toshiba-controller.h, enough to run the controller on a host.
+// Implementations live in harness.cpp.
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace esphome {
+
+template <typename T>
+using optional = std::optional<T>;
+
+uint32_t millis();
+
+__attribute__((format(printf, 3, 4))) void log_printf(int level, const char* tag, const char* format, ...);
+
+std::string format_hex_pretty(uint8_t value);
+std::string format_hex_pretty(const uint8_t* data, size_t length);
+std::string format_hex_pretty(const std::vector<uint8_t>& data);
+uint32_t fnv1_hash(const std::string& str);
+
+struct InterruptLock {
+    InterruptLock() {
+    }
+    ~InterruptLock() {
+    }
+};
+
+// flash is emulated by a handful of fixed size slots, so saving never allocates
+class ESPPreferenceObject {
+public:
+    static const size_t MAX_SIZE = 64;
+
+    ESPPreferenceObject() = default;
+    ESPPreferenceObject(uint32_t key, size_t size) : key_(key), size_(size) {
+    }
+
+    template <typename T>
+    bool save(const T* value) {
+        static_assert(sizeof(T) <= MAX_SIZE, "preference too large for the host flash");
+        return save_bytes_(reinterpret_cast<const uint8_t*>(value), sizeof(T));
+    }
+
+    template <typename T>
+    bool load(T* value) {
+        return load_bytes_(reinterpret_cast<uint8_t*>(value), sizeof(T));
+    }
+
+private:
+    uint32_t key_ = 0;
+    size_t size_ = 0;
+
+    bool save_bytes_(const uint8_t* data, size_t size);
+    bool load_bytes_(uint8_t* data, size_t size);
+};
+
+class ESPPreferences {
+public:
+    template <typename T>
+    ESPPreferenceObject make_preference(uint32_t key, bool in_flash = false) {
+        (void)in_flash;
+        return ESPPreferenceObject(key, sizeof(T));
+    }
+
+    // host only: forget everything saved so far, emulates erased flash
+    static void erase_all();
+    // host only: number of save() calls that reached the emulated flash
+    static uint32_t save_count();
+};
+
+extern ESPPreferences* global_preferences;
+
+namespace setup_priority {
+const float BUS = 1000.0f;
+}
+
+class Component {
+public:
+    virtual ~Component() = default;
+    virtual void setup() {
+    }
+    virtual void loop() {
+    }
+    virtual float get_setup_priority() const {
+        return 0;
+    }
+};
+
+class EntityBase {
+public:
+    void set_icon(const char* icon) {
+        (void)icon;
+    }
+    uint32_t get_object_id_hash() {
+        return object_id_hash_;
+    }
+    void set_object_id_hash(uint32_t hash) {
+        object_id_hash_ = hash;
+    }
+
+private:
+    uint32_t object_id_hash_ = 0;
+};
+
+namespace sensor {
+class Sensor : public EntityBase {
+public:
+    float state = NAN;
+    uint32_t publish_count = 0;  // host only
+
+    void publish_state(float value) {
+        state = value;
+        publish_count++;
+        for (auto& callback : callbacks_) {
+            callback(value);
+        }
+    }
+    float get_state() const {
+        return state;
+    }
+    void add_on_state_callback(std::function<void(float)> callback) {
+        callbacks_.push_back(std::move(callback));
+    }
+
+private:
+    std::vector<std::function<void(float)>> callbacks_;
+};
+}  // namespace sensor
+
+namespace select {
+class Select : public EntityBase {
+public:
+    std::string state;
+
+    void publish_state(const std::string& value) {
+        state = value;
+    }
+};
+}  // namespace select
+
+namespace template_ {
+class TemplateSelect : public select::Select {};
+}  // namespace template_
+
+namespace switch_ {
+enum SwitchRestoreMode { SWITCH_RESTORE_DEFAULT_OFF, SWITCH_RESTORE_DEFAULT_ON };
+
+class Switch : public EntityBase {
+public:
+    bool state = false;
+
+    virtual ~Switch() = default;
+    virtual void write_state(bool state) = 0;
+
+    void publish_state(bool value) {
+        state = value;
+    }
+    void set_restore_mode(SwitchRestoreMode mode) {
+        (void)mode;
+    }
+    optional<bool> get_initial_state_with_restore_mode() {
+        return {};
+    }
+};
+}  // namespace switch_
+
+namespace uart {
+// the methods are virtual like the driver backed implementations on the device
+class UARTComponent {
+public:
+    virtual ~UARTComponent() = default;
+    virtual int available() = 0;
+    virtual bool read_array(uint8_t* data, size_t length) = 0;
+    virtual void write_array(const uint8_t* data, size_t length) = 0;
+
+    bool read_byte(uint8_t* data) {
+        return read_array(data, 1);
+    }
+    void write_array(const std::vector<uint8_t>& data) {
+        write_array(data.data(), data.size());
+    }
+};
+}  // namespace uart
+
+namespace climate {
+enum ClimateMode : uint8_t {
+    CLIMATE_MODE_OFF,
+    CLIMATE_MODE_HEAT_COOL,
+    CLIMATE_MODE_COOL,
+    CLIMATE_MODE_HEAT,
+    CLIMATE_MODE_FAN_ONLY,
+    CLIMATE_MODE_DRY,
+    CLIMATE_MODE_AUTO,
+};
+
+enum ClimateFanMode : uint8_t {
+    CLIMATE_FAN_ON,
+    CLIMATE_FAN_OFF,
+    CLIMATE_FAN_AUTO,
+    CLIMATE_FAN_LOW,
+    CLIMATE_FAN_MEDIUM,
+    CLIMATE_FAN_HIGH,
+    CLIMATE_FAN_MIDDLE,
+    CLIMATE_FAN_FOCUS,
+    CLIMATE_FAN_DIFFUSE,
+    CLIMATE_FAN_QUIET,
+};
+
+enum ClimateSwingMode : uint8_t {
+    CLIMATE_SWING_OFF,
+    CLIMATE_SWING_BOTH,
+    CLIMATE_SWING_VERTICAL,
+    CLIMATE_SWING_HORIZONTAL,
+};
+
+class ClimateTraits {
+public:
+    void set_supported_modes(std::initializer_list<ClimateMode> modes) {
+        (void)modes;
+    }
+    void set_supported_swing_modes(std::initializer_list<ClimateSwingMode> modes) {
+        (void)modes;
+    }
+    void add_supported_fan_mode(ClimateFanMode mode) {
+        (void)mode;
+    }
+    void add_supported_custom_fan_mode(const std::string& mode) {
+        (void)mode;
+    }
+    void set_supports_current_temperature(bool supports) {
+        (void)supports;
+    }
+    void set_supports_two_point_target_temperature(bool supports) {
+        (void)supports;
+    }
+    void set_supports_action(bool supports) {
+        (void)supports;
+    }
+    void set_visual_min_temperature(float value) {
+        (void)value;
+    }
+    void set_visual_max_temperature(float value) {
+        (void)value;
+    }
+    void set_visual_current_temperature_step(float value) {
+        (void)value;
+    }
+    void set_visual_target_temperature_step(float value) {
+        (void)value;
+    }
+};
+
+class Climate;
+
+struct ClimateDeviceRestoreState {
+    void apply(Climate* climate) {
+        (void)climate;
+    }
+};
+
+class ClimateCall {
+public:
+    optional<ClimateMode> mode;
+    optional<float> target_temperature;
+    optional<ClimateFanMode> fan_mode;
+    optional<std::string> custom_fan_mode;
+    optional<ClimateSwingMode> swing_mode;
+
+    const optional<ClimateMode>& get_mode() const {
+        return mode;
+    }
+    const optional<float>& get_target_temperature() const {
+        return target_temperature;
+    }
+    const optional<ClimateFanMode>& get_fan_mode() const {
+        return fan_mode;
+    }
+    const optional<std::string>& get_custom_fan_mode() const {
+        return custom_fan_mode;
+    }
+    const optional<ClimateSwingMode>& get_swing_mode() const {
+        return swing_mode;
+    }
+};
+
+class Climate : public EntityBase {
+public:
+    ClimateMode mode = CLIMATE_MODE_OFF;
+    float target_temperature = NAN;
+    float current_temperature = NAN;
+    optional<ClimateFanMode> fan_mode;
+    optional<std::string> custom_fan_mode;
+    ClimateSwingMode swing_mode = CLIMATE_SWING_OFF;
+    uint32_t publish_count = 0;  // host only
+
+    virtual ~Climate() = default;
+    virtual ClimateTraits traits() = 0;
+    virtual void control(const ClimateCall& call) = 0;
+
+    void publish_state() {
+        publish_count++;
+    }
+
+protected:
+    optional<ClimateDeviceRestoreState> restore_state_() {
+        return {};
+    }
+    bool set_fan_mode_(ClimateFanMode mode) {
+        bool changed = !fan_mode.has_value() || *fan_mode != mode || custom_fan_mode.has_value();
+        fan_mode = mode;
+        custom_fan_mode.reset();
+        return changed;
+    }
+    bool set_custom_fan_mode_(const std::string& mode) {
+        bool changed = !custom_fan_mode.has_value() || *custom_fan_mode != mode || fan_mode.has_value();
+        custom_fan_mode = mode;
+        fan_mode.reset();
+        return changed;
+    }
+};
+}  // namespace climate
+
+}  // namespace esphome
+
+#define ESPHOME_LOG_LEVEL_NONE 0
+#define ESPHOME_LOG_LEVEL_ERROR 1
+#define ESPHOME_LOG_LEVEL_WARN 2
+#define ESPHOME_LOG_LEVEL_INFO 3
+#define ESPHOME_LOG_LEVEL_DEBUG 4
+#define ESPHOME_LOG_LEVEL_VERBOSE 5
+
+// like on the device, messages above the configured level are compiled out and their arguments never evaluated
+#ifndef ESPHOME_LOG_LEVEL
+#define ESPHOME_LOG_LEVEL ESPHOME_LOG_LEVEL_DEBUG
+#endif
+
+#define ESPHOME_LOG_AT_(level, tag, ...)              \
+    do {                                             \
+        if (level <= ESPHOME_LOG_LEVEL) {            \
+            esphome::log_printf(level, tag, __VA_ARGS__); \
+        }                                            \
+    } while (false)
+
+#define ESP_LOGE(tag, ...) ESPHOME_LOG_AT_(ESPHOME_LOG_LEVEL_ERROR, tag, __VA_ARGS__)
+#define ESP_LOGW(tag, ...) ESPHOME_LOG_AT_(ESPHOME_LOG_LEVEL_WARN, tag, __VA_ARGS__)
+#define ESP_LOGI(tag, ...) ESPHOME_LOG_AT_(ESPHOME_LOG_LEVEL_INFO, tag, __VA_ARGS__)
+#define ESP_LOGD(tag, ...) ESPHOME_LOG_AT_(ESPHOME_LOG_LEVEL_DEBUG, tag, __VA_ARGS__)
+#define ESP_LOGV(tag, ...) ESPHOME_LOG_AT_(ESPHOME_LOG_LEVEL_VERBOSE, tag, __VA_ARGS__)
+
+using namespace esphome;
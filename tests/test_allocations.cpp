@@ -0,0 +1,96 @@
+// The TX ring and steady-state operation stay off the heap. Built with logging compiled out, like a release node,
+// since formatting log arguments allocates on its own.
+#include <cstdlib>
+#include <new>
+
+#include "room_model.h"
+
+using namespace toshiba_test;
+
+namespace {
+uint32_t allocations = 0;
+}  // namespace
+
+void* operator new(size_t size) {
+    allocations++;
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+namespace {
+
+void tx_ring_is_fifo_and_bounded() {
+    TxFrameRing<4> ring;
+    uint8_t frame[TX_FRAME_MAX_LEN] = {0x02};
+    uint32_t before = allocations;
+    for (uint8_t i = 0; i < 6; i++) {
+        frame[1] = i;
+        bool queued = ring.push(frame, sizeof(frame), TX_FRAME_READ, 0xB0 + i);
+        CHECK_EQ(queued, i < 4);
+    }
+    CHECK_EQ(ring.size(), 4);
+    CHECK_EQ(ring.overflow_count(), 2u);
+    // frames longer than a slot are rejected as well
+    uint8_t oversized[TX_FRAME_MAX_LEN + 1] = {};
+    ring.pop();
+    CHECK(!ring.push(oversized, sizeof(oversized)));
+    CHECK_EQ(ring.overflow_count(), 3u);
+
+    CHECK(ring.find(TX_FRAME_READ, 0xB0) == nullptr);
+    CHECK(ring.find(TX_FRAME_READ, 0xB2) != nullptr);
+    CHECK(ring.find(TX_FRAME_WRITE, 0xB2) == nullptr);
+    for (uint8_t i = 1; i < 4; i++) {
+        CHECK_EQ(ring.front().data[1], i);
+        CHECK_EQ(ring.front().command, 0xB0 + i);
+        ring.pop();
+    }
+    CHECK(ring.empty());
+    CHECK_EQ(allocations - before, 0u);
+}
+
+// polling, pushed status frames, room sensor updates and thermostat writes for six hours once the node settled
+void steady_state_does_not_allocate() {
+    ControllerFixture fixture;
+    CHECK(fixture.initialize());
+    climate::ClimateCall call;
+    call.mode = climate::CLIMATE_MODE_HEAT;
+    call.target_temperature = 21;
+    fixture.controller.control(call);
+
+    Room room;
+    const uint32_t MODEL_STEP = 60000;
+    auto run = [&](uint32_t minutes) {
+        for (uint32_t minute = 0; minute < minutes; minute++) {
+            drive_room(fixture, room, MODEL_STEP / 1000.0);
+            fixture.run_for(MODEL_STEP, 20);
+        }
+    };
+    run(30);
+
+    uint32_t before = allocations;
+    uint32_t writes = fixture.idu.writes;
+    uint32_t frames = fixture.uart.tx_frames;
+    run(6 * 60);
+    std::printf("%u frames sent, %u register writes, %u allocations\n", fixture.uart.tx_frames - frames,
+                fixture.idu.writes - writes, allocations - before);
+    CHECK(fixture.idu.writes > writes);
+    CHECK_EQ(allocations - before, 0u);
+}
+
+}  // namespace
+
+int main() {
+    tx_ring_is_fifo_and_bounded();
+    steady_state_does_not_allocate();
+    return finish("test_allocations");
+}
@@ -0,0 +1,51 @@
+// Time from boot to a controllable climate entity, against an IDU that is ready and one that boots late.
+#include "controller_fixture.h"
+
+using namespace toshiba_test;
+
+namespace {
+
+// returns the time to is_initialized() or UINT32_MAX
+uint32_t time_to_initialized(uint32_t idu_boot_millis, bool ack_paced_tx = false, uint8_t reply_checksum = 0) {
+    ControllerFixture fixture;
+    fixture.controller.config_settings().ack_paced_tx = ack_paced_tx;
+    fixture.idu.boot_millis = idu_boot_millis;
+    fixture.idu.handshake_reply_checksum = reply_checksum;
+    fixture.setup();
+    if (!fixture.run_until([&] { return fixture.controller.is_initialized(); }, 180000)) {
+        return UINT32_MAX;
+    }
+    uint32_t initialized = sim_clock.now;
+    // the handshake must have reached the IDU, and the initial register reads must be answered
+    CHECK(fixture.idu.handshake_frames > 0);
+    CHECK(fixture.run_until([&] { return fixture.controller.mode == climate::CLIMATE_MODE_HEAT; }, 5000));
+    return initialized;
+}
+
+}  // namespace
+
+int main() {
+    // eight handshake frames at the fixed 100 ms gap, or paced by the IDU's replies
+    uint32_t ready = time_to_initialized(0);
+    uint32_t ready_paced = time_to_initialized(0, true);
+    std::printf("IDU ready at boot: initialized after %u ms, %u ms with ack_paced_tx (baseline: 16000 ms)\n", ready,
+                ready_paced);
+    CHECK(ready < 1500);
+    CHECK(ready_paced < 800);
+
+    // handshake replies were never checksum checked, units answering with a wrong one must still pace it
+    uint32_t bad_checksum = time_to_initialized(0, true, 0x55);
+    std::printf("handshake replies with a wrong checksum: initialized after %u ms\n", bad_checksum);
+    CHECK(bad_checksum < 800);
+
+    // a unit sharing the ESP's power supply answers only after it booted itself
+    const uint32_t LATE_BOOTS[] = {7000, 12000, 45000, 120000};
+    for (uint32_t boot : LATE_BOOTS) {
+        uint32_t late = time_to_initialized(boot);
+        std::printf("IDU booting after %u ms: initialized after %u ms\n", boot, late);
+        CHECK(late != UINT32_MAX);
+        CHECK(late > boot);
+        CHECK(late < boot + 31000);
+    }
+    return finish("test_handshake");
+}
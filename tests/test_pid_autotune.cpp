@@ -0,0 +1,93 @@
+// The relay auto-tuner measures the room's limit cycle and the PID law keeps tracking the target with the gains it
+// found, against the same room as the week simulation.
+#include "room_model.h"
+
+using namespace toshiba_test;
+
+namespace {
+
+const uint32_t MODEL_STEP = 60000;
+const uint32_t HOUR = 3600 * 1000;
+
+struct Simulation {
+    ControllerFixture fixture;
+    Room room;
+    uint32_t start = 0;
+    uint32_t next_model_step = 0;
+
+    explicit Simulation(bool pid) {
+        fixture.controller.config_settings().smart_thermostat_pid = pid;
+    }
+
+    bool start_heating() {
+        if (!fixture.initialize()) {
+            return false;
+        }
+        climate::ClimateCall call;
+        call.mode = climate::CLIMATE_MODE_HEAT;
+        call.target_temperature = 21;
+        fixture.controller.control(call);
+        start = next_model_step = sim_clock.now;
+        return true;
+    }
+
+    // runs with a daily outdoor swing, returns the rms tracking error
+    template <typename Predicate>
+    double run(uint32_t millis, Predicate done) {
+        double squared_error = 0;
+        uint32_t samples = 0;
+        uint32_t end = sim_clock.now + millis;
+        while ((int32_t)(end - sim_clock.now) > 0 && !done()) {
+            if ((int32_t)(sim_clock.now - next_model_step) >= 0) {
+                next_model_step += MODEL_STEP;
+                room.outdoor = 5 + 5 * std::sin((sim_clock.now - start) * 2 * M_PI / (24.0 * HOUR));
+                drive_room(fixture, room, MODEL_STEP / 1000.0);
+                double error = room.temperature - 21;
+                squared_error += error * error;
+                samples++;
+            }
+            fixture.step(20);
+        }
+        return samples > 0 ? std::sqrt(squared_error / samples) : 0;
+    }
+
+    double run(uint32_t millis) {
+        return run(millis, [] { return false; });
+    }
+};
+
+bool gains_equal(const PidGains& a, const PidGains& b) {
+    return a.kp == b.kp && a.ki == b.ki && a.kd == b.kd;
+}
+
+}  // namespace
+
+int main() {
+    ESPPreferences::erase_all();
+
+    Simulation multiplier(false);
+    CHECK(multiplier.start_heating());
+    multiplier.run(12 * HOUR);
+    double multiplier_rms = multiplier.run(48 * HOUR);
+
+    Simulation pid(true);
+    CHECK(pid.start_heating());
+    pid.run(12 * HOUR);
+    const PidGains configured = pid.fixture.controller.pid_gains();
+    pid.fixture.controller.start_pid_autotune();
+    uint32_t tuning_start = sim_clock.now;
+    pid.run(14 * HOUR, [&] { return !gains_equal(pid.fixture.controller.pid_gains(), configured); });
+    uint32_t tuning_minutes = (sim_clock.now - tuning_start) / 60000;
+    const PidGains tuned = pid.fixture.controller.pid_gains();
+    CHECK(!gains_equal(tuned, configured));
+    CHECK(tuned.kp > 0 && tuned.ki > 0);
+
+    pid.run(12 * HOUR);
+    double pid_rms = pid.run(48 * HOUR);
+
+    std::printf("auto-tuning took %u min: kp %.3f ki %.5f kd %.1f, rms error %.2f °C (multiplier %.2f °C)\n",
+                tuning_minutes, tuned.kp, tuned.ki, tuned.kd, pid_rms, multiplier_rms);
+    CHECK(pid_rms < 0.3);
+    CHECK(pid_rms <= multiplier_rms);
+    return finish("test_pid_autotune");
+}
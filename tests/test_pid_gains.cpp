@@ -0,0 +1,74 @@
+// Auto-tuned PID gains survive a restart, but never outlive an edit of the configured gains or the reset button.
+#include "controller_fixture.h"
+
+using namespace toshiba_test;
+
+namespace {
+
+// mirrors the controller's stored gains
+struct StoredGains {
+    PidGains tuned;
+    PidGains configured;
+    bool valid;
+};
+
+const PidGains TUNED = {1.5f, 0.0004f, 0.0f};
+
+void store_tuned_gains(ControllerFixture& fixture) {
+    const ConfigSettings defaults;
+    StoredGains stored{TUNED, {defaults.pid_kp, defaults.pid_ki, defaults.pid_kd}, true};
+    global_preferences
+        ->make_preference<StoredGains>(fixture.controller.get_object_id_hash() ^ fnv1_hash("toshiba_pid_gains"), true)
+        .save(&stored);
+}
+
+bool gains_equal(const PidGains& a, const PidGains& b) {
+    return a.kp == b.kp && a.ki == b.ki && a.kd == b.kd;
+}
+
+void tuned_gains_are_restored() {
+    ESPPreferences::erase_all();
+    ControllerFixture fixture;
+    store_tuned_gains(fixture);
+    fixture.setup();
+    CHECK(gains_equal(fixture.controller.pid_gains(), TUNED));
+}
+
+void edited_gains_win_over_tuned_ones() {
+    ESPPreferences::erase_all();
+    ControllerFixture fixture;
+    store_tuned_gains(fixture);
+    fixture.controller.config_settings().pid_kp = 6.0f;
+    fixture.setup();
+    CHECK_EQ(fixture.controller.pid_gains().kp, 6.0f);
+}
+
+void reset_reverts_to_configured_gains() {
+    ESPPreferences::erase_all();
+    const ConfigSettings defaults;
+    const PidGains configured = {defaults.pid_kp, defaults.pid_ki, defaults.pid_kd};
+    {
+        ControllerFixture fixture;
+        store_tuned_gains(fixture);
+        fixture.controller.config_settings().smart_thermostat_pid = true;
+        CHECK(fixture.initialize());
+        CHECK(gains_equal(fixture.controller.pid_gains(), TUNED));
+        fixture.controller.reset_pid_gains();
+        fixture.run_for(100);
+        CHECK(gains_equal(fixture.controller.pid_gains(), configured));
+    }
+
+    // and stays reset across a restart
+    ControllerFixture fixture;
+    fixture.setup();
+    CHECK(gains_equal(fixture.controller.pid_gains(), configured));
+}
+
+}  // namespace
+
+int main() {
+    tuned_gains_are_restored();
+    edited_gains_win_over_tuned_ones();
+    reset_reverts_to_configured_gains();
+    return finish("test_pid_gains");
+}
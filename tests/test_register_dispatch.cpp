@@ -0,0 +1,99 @@
+// Every register frame is decoded and published through its descriptor table entry, pushed (15 bytes) or requested
+// (17 bytes), and a frame costs one indexed lookup on top of its decoding. Timings are host numbers and only printed.
+#include <chrono>
+
+#include "controller_fixture.h"
+
+using namespace toshiba_test;
+
+namespace {
+
+// delivers one register frame and runs a loop() pass over it
+void receive(ControllerFixture& fixture, uint8_t command, uint8_t value, bool requested = false) {
+    uint8_t frame[EmulatedIdu::FRAME_MAX];
+    fixture.idu.registers[command] = value;
+    fixture.uart.inject(frame, EmulatedIdu::make_register_frame(frame, command, value, requested));
+    fixture.step();
+}
+
+void every_register_is_decoded() {
+    ControllerFixture fixture;
+    CHECK(fixture.initialize());
+    fixture.run_for(2000);
+    // keep the controller's own polls and writes from answering in between
+    fixture.uart.set_sink(nullptr);
+    auto& controller = fixture.controller;
+
+    receive(fixture, ToshibaCommand::MODE, ToshibaMode::MODE_COOL);
+    CHECK_EQ(controller.mode, climate::CLIMATE_MODE_COOL);
+    receive(fixture, ToshibaCommand::MODE, ToshibaMode::MODE_DRY, true);
+    CHECK_EQ(controller.mode, climate::CLIMATE_MODE_DRY);
+    receive(fixture, ToshibaCommand::FAN_MODE, ToshibaFanMode::FAN_LOW_MEDIUM);
+    CHECK(controller.custom_fan_mode.has_value() && *controller.custom_fan_mode == CUSTOM_FAN_MODE_LOW_MEDIUM);
+    receive(fixture, ToshibaCommand::FAN_MODE, ToshibaFanMode::FAN_AUTO, true);
+    CHECK(controller.fan_mode.has_value() && *controller.fan_mode == climate::CLIMATE_FAN_AUTO);
+    receive(fixture, ToshibaCommand::SWING_MODE, ToshibaSwingMode::SWING_MODE_SWING_VERTICAL);
+    CHECK_EQ(controller.swing_mode, climate::CLIMATE_SWING_VERTICAL);
+    receive(fixture, ToshibaCommand::SWING_MODE, ToshibaSwingMode::SWING_MODE_FIXED_3);
+    CHECK_EQ(controller.swing_mode, climate::CLIMATE_SWING_OFF);
+    receive(fixture, ToshibaCommand::MODE, 0x4F);
+    CHECK_EQ(controller.mode, climate::CLIMATE_MODE_OFF);
+    receive(fixture, ToshibaCommand::TARGET_TEMPERATURE, 24);
+    CHECK_EQ(controller.target_temperature, 24.0f);
+    CHECK_EQ(controller.get_sensors()[SENSOR_FCU_SETPOINT]->state, 24.0f);
+    receive(fixture, ToshibaCommand::ROOM_TEMPERATURE, 26);
+    CHECK_EQ(controller.get_sensors()[SENSOR_FCU_AIR_TEMP]->state, 26.0f);
+    receive(fixture, ToshibaCommand::OUTDOOR_TEMPERATURE, (uint8_t)-3);
+    CHECK_EQ(controller.get_sensors()[SENSOR_OUTDOOR_TEMPERATURE]->state, -3.0f);
+    receive(fixture, ToshibaCommand::IONIZER, ToshibaIonizer::IONIZER_ON);
+    CHECK(controller.get_switches()[1]->state);
+    receive(fixture, ToshibaCommand::SPECIAL_MODE, ToshibaSpecialModes::SPECIAL_MODE_ECO);
+    CHECK(fixture.special_mode_select.state == "Eco");
+    receive(fixture, ToshibaCommand::POWER_SELECT, ToshibaPowerSelection::POWER_75);
+    CHECK(fixture.power_select.state == "75%");
+    receive(fixture, ToshibaCommand::POWER_STATE, ToshibaState::STATE_OFF);
+    CHECK_EQ(controller.mode, climate::CLIMATE_MODE_OFF);
+}
+
+void dispatch_cost() {
+    ControllerFixture fixture;
+    CHECK(fixture.initialize());
+    fixture.run_for(2000);
+    fixture.uart.set_sink(nullptr);
+
+    // values the controller already holds, so only the lookup and the unchanged-value path run
+    const uint8_t commands[] = {
+        ToshibaCommand::FAN_MODE,         ToshibaCommand::SWING_MODE,          ToshibaCommand::MODE,
+        ToshibaCommand::ROOM_TEMPERATURE, ToshibaCommand::OUTDOOR_TEMPERATURE, ToshibaCommand::IONIZER,
+    };
+    uint8_t burst[sizeof(commands) * 17];
+    uint16_t burst_len = 0;
+    for (uint8_t command : commands) {
+        burst_len += EmulatedIdu::make_register_frame(&burst[burst_len], command, fixture.idu.registers[command], true);
+    }
+
+    const uint32_t ROUNDS = 50000;
+    auto time_loops = [&](bool with_frames) {
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t round = 0; round < ROUNDS; round++) {
+            if (with_frames) {
+                fixture.uart.inject(burst, burst_len);
+            }
+            static_cast<Component&>(fixture.controller).loop();
+        }
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    };
+    double idle = time_loops(false);
+    double busy = time_loops(true);
+    CHECK_EQ(fixture.uart.available(), 0);
+    std::printf("%.0f ns per register frame (framing, checksum, lookup, handler), index table %zu bytes\n",
+                (busy - idle) / (ROUNDS * sizeof(commands)), sizeof(RegisterIndex));
+}
+
+}  // namespace
+
+int main() {
+    every_register_is_decoded();
+    dispatch_cost();
+    return finish("test_register_dispatch");
+}
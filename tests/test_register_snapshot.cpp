@@ -0,0 +1,107 @@
+// The register snapshot restores the last known state before the IDU answers, also when it was stored by a build
+// with the registers in a different order.
+#include "controller_fixture.h"
+
+using namespace toshiba_test;
+
+namespace {
+
+// mirrors the controller's snapshot layout for its 12 registers
+struct StoredSnapshot {
+    uint8_t commands[12];
+    uint8_t values[12];
+    uint16_t received_mask;
+};
+
+ESPPreferenceObject snapshot_preference(ControllerFixture& fixture) {
+    return global_preferences->make_preference<StoredSnapshot>(
+        fixture.controller.get_object_id_hash() ^ fnv1_hash("toshiba_register_snapshot"), true);
+}
+
+void snapshot_survives_a_restart() {
+    ESPPreferences::erase_all();
+    // the smart thermostat moves the IDU setpoint, the snapshot holds whatever the IDU confirmed last
+    uint8_t setpoint;
+    {
+        ControllerFixture fixture;
+        fixture.idu.registers[ToshibaCommand::MODE] = ToshibaMode::MODE_COOL;
+        CHECK(fixture.initialize());
+        fixture.run_for(SNAPSHOT_MIN_SAVE_INTERVAL + 60000, 100);
+        CHECK(ESPPreferences::save_count() > 0);
+        setpoint = fixture.idu.registers[ToshibaCommand::TARGET_TEMPERATURE];
+    }
+
+    // the IDU stays silent, everything shown comes from the snapshot
+    ControllerFixture fixture;
+    fixture.idu.boot_millis = UINT32_MAX;
+    fixture.setup();
+    fixture.run_for(1000);
+    CHECK(!fixture.controller.is_initialized());
+    CHECK_EQ(fixture.controller.mode, climate::CLIMATE_MODE_COOL);
+    CHECK_EQ(fixture.controller.get_sensors()[2]->state, (float)setpoint);
+}
+
+// the first snapshot goes out once the IDU confirmed the registers, later changes wait for the throttle
+void first_snapshot_is_saved_once_confirmed() {
+    ESPPreferences::erase_all();
+    ControllerFixture fixture;
+    CHECK(fixture.initialize());
+    fixture.run_for(60000, 100);
+    StoredSnapshot stored{};
+    CHECK(snapshot_preference(fixture).load(&stored));
+    CHECK_EQ(stored.values[5], ToshibaMode::MODE_HEAT);
+
+    fixture.idu.push_register(ToshibaCommand::MODE, ToshibaMode::MODE_COOL);
+    fixture.run_for(60000, 100);
+    CHECK_EQ(fixture.controller.mode, climate::CLIMATE_MODE_COOL);
+    CHECK(snapshot_preference(fixture).load(&stored));
+    CHECK_EQ(stored.values[5], ToshibaMode::MODE_HEAT);
+    fixture.run_for(SNAPSHOT_MIN_SAVE_INTERVAL, 100);
+    CHECK(snapshot_preference(fixture).load(&stored));
+    CHECK_EQ(stored.values[5], ToshibaMode::MODE_COOL);
+}
+
+// a snapshot written in reverse register order must still reach the right handlers
+void reordered_snapshot_is_restored_by_command() {
+    ESPPreferences::erase_all();
+    const uint8_t commands[] = {
+        ToshibaCommand::ODU_STATUS,
+        ToshibaCommand::IDU_STATUS,
+        ToshibaCommand::IONIZER,
+        ToshibaCommand::OUTDOOR_TEMPERATURE,
+        ToshibaCommand::ROOM_TEMPERATURE,
+        ToshibaCommand::TARGET_TEMPERATURE,
+        ToshibaCommand::MODE,
+        ToshibaCommand::SWING_MODE,
+        ToshibaCommand::FAN_MODE,
+        ToshibaCommand::POWER_SELECT,
+        ToshibaCommand::SPECIAL_MODE,
+        ToshibaCommand::POWER_STATE,
+    };
+    ControllerFixture fixture;
+    StoredSnapshot stored{};
+    for (uint8_t entry = 0; entry < 12; entry++) {
+        stored.commands[entry] = commands[entry];
+        stored.values[entry] = fixture.idu.registers[commands[entry]];
+    }
+    stored.values[5] = 25;
+    stored.values[6] = ToshibaMode::MODE_COOL;
+    // the status digests were never received
+    stored.received_mask = 0xFFF & ~0x3;
+    snapshot_preference(fixture).save(&stored);
+
+    fixture.idu.boot_millis = UINT32_MAX;
+    fixture.setup();
+    fixture.run_for(1000);
+    CHECK_EQ(fixture.controller.mode, climate::CLIMATE_MODE_COOL);
+    CHECK_EQ(fixture.controller.get_sensors()[2]->state, 25.0f);
+}
+
+}  // namespace
+
+int main() {
+    snapshot_survives_a_restart();
+    first_snapshot_is_saved_once_confirmed();
+    reordered_snapshot_is_restored_by_command();
+    return finish("test_register_snapshot");
+}
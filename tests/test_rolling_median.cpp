@@ -0,0 +1,127 @@
+// RollingMedianWindow against the deque + nth_element history it replaced, fed with the same sample stream.
+#include <algorithm>
+#include <deque>
+#include <random>
+#include <vector>
+
+#include "harness.h"
+#include "toshiba-controller.h"
+
+using namespace toshiba_test;
+
+namespace {
+
+const uint32_t MAX_AGE = 900000;
+const uint8_t MIN_SAMPLES = 10;
+
+// the previous offset history, kept verbatim apart from the sample type
+template <typename T>
+struct ReferenceHistory {
+    std::deque<std::pair<T, long>> history;
+
+    void push(T value, long time) {
+        history.emplace_back(value, time);
+    }
+
+    void expire(long now) {
+        while (history.size() > MIN_SAMPLES && now - history.front().second > (long)MAX_AGE) {
+            history.pop_front();
+        }
+    }
+
+    std::vector<T> errors() const {
+        std::vector<T> errors;
+        for (const auto& item : history) {
+            errors.push_back(item.first);
+        }
+        return errors;
+    }
+
+    // nth_element only places element n, errors[n - 1] is any element of the lower part
+    T nth_element_median() const {
+        std::vector<T> errors = this->errors();
+        size_t n = errors.size() / 2;
+        std::nth_element(errors.begin(), errors.begin() + n, errors.end());
+        return errors.size() % 2 == 0 ? (errors[n - 1] + errors[n]) / 2 : errors[n];
+    }
+
+    T sorted_median() const {
+        std::vector<T> errors = this->errors();
+        std::sort(errors.begin(), errors.end());
+        size_t n = errors.size() / 2;
+        return errors.size() % 2 == 0 ? (errors[n - 1] + errors[n]) / 2 : errors[n];
+    }
+
+    T mean() const {
+        T sum = 0;
+        for (const auto& item : history) {
+            sum += item.first;
+        }
+        return sum / (T)history.size();
+    }
+};
+
+// offsets of a whole degree IDU reading against a 0.1 °C sensor, sampled every 30 s with gaps in the stream
+template <typename T>
+void matches_reference(T scale, const char* name) {
+    std::mt19937 rng(21);
+    std::uniform_int_distribution<int> offset(-25, 25);
+    std::uniform_int_distribution<int> gap(1, 40);
+
+    RollingMedianWindow<T, 64> window;
+    ReferenceHistory<T> reference;
+    uint32_t now = 0;
+    uint32_t even_medians = 0;
+    uint32_t nth_element_mismatches = 0;
+    for (int sample = 0; sample < 20000; sample++) {
+        // mostly the regular tick, sometimes a long pause that lets the window shrink to its minimum
+        now += gap(rng) == 1 ? 20 * 60000 : 30000;
+        T value = offset(rng) * scale;
+        window.push(value, now);
+        reference.push(value, now);
+        window.expire(now, MAX_AGE, MIN_SAMPLES);
+        reference.expire(now);
+
+        CHECK_EQ(window.size(), reference.history.size());
+        CHECK_EQ(window.median(), reference.sorted_median());
+        CHECK(std::fabs((double)window.mean() - (double)reference.mean()) <= 1e-9 * std::fabs((double)scale) * 64);
+        if (window.size() % 2 == 0) {
+            even_medians++;
+            nth_element_mismatches += window.median() != reference.nth_element_median();
+        } else {
+            CHECK_EQ(window.median(), reference.nth_element_median());
+        }
+    }
+    CHECK(even_medians > 0);
+    std::printf("%s: %u of %u even sized medians differ from nth_element, which averaged an arbitrary lower sample\n",
+                name, nth_element_mismatches, even_medians);
+}
+
+void even_size_takes_the_two_middle_samples() {
+    RollingMedianWindow<double, 8> window;
+    for (double value : {4.0, 1.0, 3.0, 2.0}) {
+        window.push(value, 0);
+    }
+    CHECK_EQ(window.median(), 2.5);
+    CHECK_EQ(window.mean(), 2.5);
+}
+
+void full_window_drops_the_oldest_sample() {
+    RollingMedianWindow<int32_t, 4> window;
+    for (int32_t value : {100, 200, 300, 400, 500}) {
+        window.push(value, 0);
+    }
+    CHECK_EQ(window.size(), 4);
+    CHECK_EQ(window.median(), 350);
+    CHECK_EQ(window.mean(), 350);
+}
+
+}  // namespace
+
+int main() {
+    matches_reference<double>(0.1, "double");
+    matches_reference<int32_t>(10, "centi-degrees");
+    even_size_takes_the_two_middle_samples();
+    full_window_drops_the_oldest_sample();
+    return finish("test_rolling_median");
+}
@@ -0,0 +1,126 @@
+// A burst of pushed frames is drained in one loop() pass with a handful of UART reads, where the previous reader
+// made one read_byte() call per byte and stopped after 32 bytes per pass. Host timings leave out the per call cost
+// of the ESP's UART driver that the bulk read saves, so they are printed but not checked.
+#include <chrono>
+
+#include "controller_fixture.h"
+
+using namespace toshiba_test;
+
+namespace {
+
+// the previous reader: available()/read_byte() per byte, at most 32 bytes per loop() pass
+struct PerByteReader {
+    uint8_t buf[256] = {};
+    uint16_t len = 0;
+    uint32_t frames = 0;
+
+    void read(uart::UARTComponent& uart) {
+        uint8_t count = 0;
+        while (uart.available() > 0 && count < 32) {
+            if (!uart.read_byte(&buf[len])) {
+                break;
+            }
+            len++;
+            if (len >= 7 && buf[6] + 8 == len) {
+                frames++;
+                len = 0;
+            }
+            count++;
+        }
+    }
+};
+
+// what an IR remote change looks like on the wire: a run of pushed registers and both status frames
+struct Burst {
+    uint8_t data[256];
+    uint16_t len = 0;
+    uint8_t frames = 0;
+
+    explicit Burst(EmulatedIdu& idu, uint8_t room) {
+        const uint8_t commands[] = {ToshibaCommand::POWER_STATE, ToshibaCommand::MODE, ToshibaCommand::FAN_MODE,
+                                    ToshibaCommand::SWING_MODE, ToshibaCommand::TARGET_TEMPERATURE,
+                                    ToshibaCommand::POWER_SELECT, ToshibaCommand::IONIZER,
+                                    ToshibaCommand::SPECIAL_MODE, ToshibaCommand::OUTDOOR_TEMPERATURE};
+        for (uint8_t command : commands) {
+            add(EmulatedIdu::make_register_frame(&data[len], command, idu.registers[command], false));
+        }
+        add(idu.make_status_frame(&data[len], ToshibaCommand::ODU_STATUS, false));
+        add(idu.make_status_frame(&data[len], ToshibaCommand::IDU_STATUS, false));
+        add(EmulatedIdu::make_register_frame(&data[len], ToshibaCommand::ROOM_TEMPERATURE, room, false));
+    }
+
+    void add(uint8_t frame_len) {
+        len += frame_len;
+        frames++;
+    }
+};
+
+const uint32_t ROUNDS = 20000;
+
+void controller_drains_a_burst_in_one_pass() {
+    ControllerFixture fixture;
+    CHECK(fixture.initialize());
+    fixture.run_for(60000);
+
+    // idle the line so that the burst is all there is to read
+    fixture.uart.set_sink(nullptr);
+    fixture.run_for(1000);
+    fixture.idu.td = 71;
+    Burst burst(fixture.idu, 23);
+    fixture.uart.inject(burst.data, burst.len);
+    uint32_t reads = fixture.uart.rx_calls;
+    fixture.step();
+    uint32_t reads_per_burst = fixture.uart.rx_calls - reads;
+    CHECK_EQ(fixture.uart.available(), 0);
+    CHECK_EQ(fixture.controller.get_sensors()[1]->state, 23.0f);
+    CHECK_EQ(fixture.controller.get_sensors()[6]->state, 71.0f);
+    CHECK(reads_per_burst <= 2);
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t round = 0; round < ROUNDS; round++) {
+        fixture.uart.inject(burst.data, burst.len);
+        static_cast<Component&>(fixture.controller).loop();
+    }
+    double micros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    CHECK_EQ(fixture.uart.available(), 0);
+    std::printf("bulk read:     %u byte burst in 1 pass, %u UART reads, %.1f bytes/us including dispatch\n",
+                burst.len, reads_per_burst, burst.len * (double)ROUNDS / micros);
+}
+
+void per_byte_reader_needs_a_pass_per_32_bytes() {
+    FakeUart uart;
+    EmulatedIdu idu(&uart);
+    Burst burst(idu, 23);
+    PerByteReader reader;
+
+    uart.inject(burst.data, burst.len);
+    uint32_t passes = 0;
+    while (uart.available() > 0) {
+        reader.read(uart);
+        passes++;
+    }
+    CHECK_EQ(reader.frames, burst.frames);
+    CHECK_EQ(passes, (burst.len + 31u) / 32u);
+    CHECK_EQ(uart.rx_calls, (uint32_t)burst.len);
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t round = 0; round < ROUNDS; round++) {
+        uart.inject(burst.data, burst.len);
+        while (uart.available() > 0) {
+            reader.read(uart);
+        }
+    }
+    double micros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    CHECK_EQ(reader.frames, burst.frames * (ROUNDS + 1));
+    std::printf("per byte read: %u byte burst in %u passes, %u UART reads, %.1f bytes/us framing only\n", burst.len,
+                passes, burst.len, burst.len * (double)ROUNDS / micros);
+}
+
+}  // namespace
+
+int main() {
+    controller_drains_a_burst_in_one_pass();
+    per_byte_reader_needs_a_pass_per_32_bytes();
+    return finish("test_rx_throughput");
+}
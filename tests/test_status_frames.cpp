@@ -0,0 +1,109 @@
+// Status frames are decoded into the IDU/ODU sensors whether pushed or requested, and a status sized frame carrying
+// any other command is dropped before it reaches a register's poll state.
+#include "controller_fixture.h"
+
+using namespace toshiba_test;
+
+namespace {
+
+float sensor_state(ControllerFixture& fixture, uint8_t index) {
+    return fixture.controller.get_sensors()[index]->state;
+}
+
+void requested_status_is_decoded() {
+    ControllerFixture fixture;
+    fixture.idu.tc = 31;
+    fixture.idu.tcj = 36;
+    fixture.idu.fan_rpm = 90;
+    fixture.idu.td = 61;
+    fixture.idu.ts = 6;
+    fixture.idu.te = 3;
+    fixture.idu.load = 85;
+    fixture.idu.iac = 7;
+    CHECK(fixture.initialize());
+    fixture.run_for(20000);
+
+    CHECK_EQ(sensor_state(fixture, 3), 31.0f);
+    CHECK_EQ(sensor_state(fixture, 4), 36.0f);
+    CHECK_EQ(sensor_state(fixture, 5), 90.0f);
+    CHECK_EQ(sensor_state(fixture, 6), 61.0f);
+    CHECK_EQ(sensor_state(fixture, 7), 6.0f);
+    CHECK_EQ(sensor_state(fixture, 8), 3.0f);
+    CHECK_EQ(sensor_state(fixture, 9), 85.0f / 1.7f);
+    CHECK_EQ(sensor_state(fixture, 10), 7.0f);
+}
+
+void pushed_status_is_decoded() {
+    ControllerFixture fixture;
+    CHECK(fixture.initialize());
+    fixture.run_for(2000);
+
+    fixture.idu.td = 70;
+    fixture.idu.load = 17;
+    fixture.idu.push_status(ToshibaCommand::ODU_STATUS);
+    fixture.idu.tc = 25;
+    fixture.idu.push_status(ToshibaCommand::IDU_STATUS);
+    fixture.run_for(500);
+    CHECK_EQ(sensor_state(fixture, 6), 70.0f);
+    CHECK_EQ(sensor_state(fixture, 9), 10.0f);
+    CHECK_EQ(sensor_state(fixture, 3), 25.0f);
+}
+
+// a garbled 22 byte frame with the mode command must not count as a push of the mode register, otherwise mode is
+// only polled as fallback and a change the IDU does not push goes unnoticed for minutes
+void status_sized_register_frame_is_ignored() {
+    ControllerFixture fixture;
+    CHECK(fixture.initialize());
+    fixture.run_for(2000);
+
+    uint32_t mode_reads = fixture.idu.reads_of[ToshibaCommand::MODE];
+    for (int i = 0; i < 60; i++) {
+        fixture.idu.push_status(ToshibaCommand::MODE);
+        fixture.run_for(10000, 100);
+    }
+    CHECK(fixture.idu.reads_of[ToshibaCommand::MODE] - mode_reads >= 2);
+    CHECK_EQ(fixture.controller.mode, climate::CLIMATE_MODE_HEAT);
+
+    fixture.idu.registers[ToshibaCommand::MODE] = ToshibaMode::MODE_COOL;
+    CHECK(fixture.run_until([&] { return fixture.controller.mode == climate::CLIMATE_MODE_COOL; }, 300000, 100));
+}
+
+// without a heartbeat the configured deadband still holds back fan speed jitter, unfiltered sensors publish every frame
+void sensor_filters_apply_without_heartbeat() {
+    ControllerFixture fixture;
+    fixture.controller.config_settings().publish_heartbeat_seconds = 0;
+    fixture.controller.config_settings().sensor_filters[SENSOR_FCU_FAN_RPM] = {2, 0.05, 30};
+    fixture.idu.fan_rpm = 60;
+    CHECK(fixture.initialize());
+    fixture.run_for(2000);
+    sensor::Sensor* fan_rpm = fixture.controller.get_sensors()[SENSOR_FCU_FAN_RPM];
+    sensor::Sensor* tc = fixture.controller.get_sensors()[SENSOR_FCU_TC_TEMP];
+    CHECK_EQ(fan_rpm->state, 60.0f);
+
+    fixture.run_for(31000);
+    uint32_t fan_publishes = fan_rpm->publish_count;
+    uint32_t tc_publishes = tc->publish_count;
+    fixture.idu.fan_rpm = 62;
+    fixture.idu.push_status(ToshibaCommand::IDU_STATUS);
+    fixture.run_for(100);
+    fixture.idu.push_status(ToshibaCommand::IDU_STATUS);
+    fixture.run_for(100);
+    CHECK_EQ(fan_rpm->publish_count, fan_publishes);
+    CHECK_EQ(fan_rpm->state, 60.0f);
+    CHECK(tc->publish_count >= tc_publishes + 2);
+
+    fixture.idu.fan_rpm = 90;
+    fixture.idu.push_status(ToshibaCommand::IDU_STATUS);
+    fixture.run_for(100);
+    CHECK_EQ(fan_rpm->state, 90.0f);
+}
+
+}  // namespace
+
+int main() {
+    requested_status_is_decoded();
+    pushed_status_is_decoded();
+    status_sized_register_frame_is_ignored();
+    sensor_filters_apply_without_heartbeat();
+    return finish("test_status_frames");
+}
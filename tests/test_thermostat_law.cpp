@@ -0,0 +1,180 @@
+// smart_thermostat_law against a verbatim copy of the inline law it replaced, each path carrying its own runaway
+// and rounding state over random room temperature walks. The double path, the default, has to match it bit for bit.
+// The opt-in centi-degree path has to match as well wherever the inputs are exact in both binary and decimal; on
+// 0.1 °C sensor traces the float inputs sit a few ULP off their decimal value (21.3 is 21.299999), so it may round
+// a tie the other way and its divergence is only reported.
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "harness.h"
+#include "toshiba-controller.h"
+
+using namespace toshiba_test;
+
+namespace {
+
+struct Sample {
+    float target;
+    float room;
+    int8_t idu_room;
+    double median_error;
+    double multiplier;
+    bool runaway_protection;
+};
+
+// the inline law before it became smart_thermostat_law(), runaway and rounding state passed in
+uint8_t previous_law(const Sample& s, int& thermal_runaway_fix, uint8_t& thermostat_rounding_mode,
+                     double& raw_setpoint) {
+    double room_temp = s.room;
+    double median_error = s.median_error;
+    double target_error = s.target - room_temp;
+    double target_setpoint = s.target + median_error + target_error * s.multiplier;
+
+    if (s.runaway_protection) {
+        if (target_error > std::max(0.25, 1.0 / s.multiplier)) {
+            thermal_runaway_fix = 1;
+        } else if (target_error < -std::max(0.25, 1.0 / s.multiplier)) {
+            thermal_runaway_fix = -1;
+        } else if (std::abs(target_error) < 0.15) {
+            thermal_runaway_fix = 0;
+        }
+
+        if (thermal_runaway_fix == 1) {
+            target_setpoint = std::max((double)s.target, target_setpoint);
+            target_setpoint = std::max((double)s.idu_room, target_setpoint);
+            target_setpoint = std::max((double)s.target + median_error, target_setpoint);
+            target_setpoint += 3.0;
+        } else if (thermal_runaway_fix == -1) {
+            target_setpoint = std::min((double)s.target, target_setpoint);
+            target_setpoint = std::min((double)s.idu_room, target_setpoint);
+            target_setpoint = std::min((double)s.target + median_error, target_setpoint);
+            target_setpoint -= 3.0;
+        }
+    }
+
+    if (target_error > 0.2) {
+        thermostat_rounding_mode = 1;
+    } else if (target_error < -0.2) {
+        thermostat_rounding_mode = -1;
+    }
+    uint8_t target_setpoint_int = std::floor(std::min(255.0, std::max(0.0, target_setpoint)));
+    if (thermostat_rounding_mode == 1) {
+        target_setpoint_int = std::ceil(std::min(255.0, std::max(0.0, target_setpoint)));
+    }
+
+    raw_setpoint = target_setpoint;
+    return std::max<uint8_t>(MIN_TEMP_SETPOINT_HEATING, std::min<uint8_t>(MAX_TEMP_SETPOINT, target_setpoint_int));
+}
+
+ThermostatLawInput<double> double_input(const Sample& s) {
+    return {s.target, s.room, (double)s.idu_room, s.median_error, s.multiplier, s.runaway_protection,
+            MIN_TEMP_SETPOINT_HEATING, MAX_TEMP_SETPOINT};
+}
+
+// converted the way the controller does on ESP8266, the offset history holds centi-degrees there
+ThermostatLawInput<int32_t> fixed_input(const Sample& s) {
+    using M = ThermostatMath<int32_t>;
+    return {M::from(s.target),
+            M::from(s.room),
+            M::from(s.idu_room),
+            M::from(s.idu_room) - M::from(s.room),
+            M::from(s.multiplier),
+            s.runaway_protection,
+            MIN_TEMP_SETPOINT_HEATING,
+            MAX_TEMP_SETPOINT};
+}
+
+// rooms drifting in sensor steps around occasionally changing targets, 1000 evaluations per trace. the exact grid
+// uses quarter degrees and integer multipliers, which both paths represent without rounding
+std::vector<Sample> make_traces(uint32_t count, bool exact_grid) {
+    std::mt19937 rng(22);
+    std::uniform_int_distribution<int> step(-1, 1);
+    std::uniform_int_distribution<int> pick(0, 3);
+    std::uniform_int_distribution<int> idu_offset(0, 3);
+    const float sensor_step = exact_grid ? 0.25f : 0.1f;
+    const float targets[] = {19.0f, 20.5f, 21.0f, exact_grid ? 22.25f : 22.5f};
+    const double multipliers[] = {4.0, exact_grid ? 3.0 : 2.5, exact_grid ? 2.0 : 3.0, exact_grid ? 1.0 : 1.5};
+
+    std::vector<Sample> samples;
+    samples.reserve(count);
+    int room_steps = std::lround(20 / sensor_step);
+    Sample sample{};
+    for (uint32_t i = 0; i < count; i++) {
+        if (i % 1000 == 0) {
+            sample.multiplier = multipliers[pick(rng)];
+            sample.runaway_protection = pick(rng) % 2 == 0;
+        }
+        if (i % 100 == 0) {
+            sample.target = targets[pick(rng)];
+        }
+        room_steps = std::max(std::lround(15 / sensor_step),
+                              std::min(std::lround(27 / sensor_step), (long)room_steps + step(rng)));
+        sample.room = exact_grid ? room_steps * sensor_step : room_steps / 10.0f;
+        sample.idu_room = std::lround(sample.room + idu_offset(rng));
+        sample.median_error = (double)sample.idu_room - sample.room;
+        samples.push_back(sample);
+    }
+    return samples;
+}
+
+struct Mismatches {
+    uint32_t double_path = 0;
+    uint32_t fixed_path = 0;
+};
+
+Mismatches compare(const std::vector<Sample>& samples) {
+    int runaway_fix = 0;
+    uint8_t rounding_mode = 0;
+    ThermostatLawState double_state;
+    ThermostatLawState fixed_state;
+    Mismatches mismatches;
+    for (const Sample& s : samples) {
+        double reference_raw;
+        uint8_t reference = previous_law(s, runaway_fix, rounding_mode, reference_raw);
+
+        double raw;
+        uint8_t setpoint = smart_thermostat_law(double_input(s), double_state, raw);
+        mismatches.double_path += setpoint != reference || raw != reference_raw;
+
+        int32_t fixed_raw;
+        uint8_t fixed = smart_thermostat_law(fixed_input(s), fixed_state, fixed_raw);
+        mismatches.fixed_path += fixed != reference;
+    }
+    return mismatches;
+}
+
+}  // namespace
+
+int main() {
+    const std::vector<Sample> samples = make_traces(1000000, false);
+    Mismatches sensor_traces = compare(samples);
+    CHECK_EQ(sensor_traces.double_path, 0u);
+
+    Mismatches exact_traces = compare(make_traces(1000000, true));
+    CHECK_EQ(exact_traces.double_path, 0u);
+    CHECK_EQ(exact_traces.fixed_path, 0u);
+
+    const uint32_t TIMED = 200000;
+    ThermostatLawState state;
+    uint32_t checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < TIMED; i++) {
+        double raw;
+        checksum += smart_thermostat_law(double_input(samples[i]), state, raw);
+    }
+    auto middle = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < TIMED; i++) {
+        int32_t raw;
+        checksum += smart_thermostat_law(fixed_input(samples[i]), state, raw);
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    std::printf("%zu evaluations each: double matches the previous law, centi-degrees match on the exact grid and "
+                "differ in %u (%.2f%%) on 0.1 °C sensor traces\n",
+                samples.size(), sensor_traces.fixed_path, 100.0 * sensor_traces.fixed_path / samples.size());
+    std::printf("host cost per evaluation including input conversion: double %.0f ns, centi-degrees %.0f ns (%u)\n",
+                std::chrono::duration<double, std::nano>(middle - start).count() / TIMED,
+                std::chrono::duration<double, std::nano>(end - middle).count() / TIMED, checksum);
+    return finish("test_thermostat_law");
+}
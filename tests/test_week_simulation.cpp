@@ -0,0 +1,56 @@
+// A week of smart thermostat operation against the emulated IDU and a first-order room, in simulated time.
+#include <chrono>
+
+#include "room_model.h"
+
+using namespace toshiba_test;
+
+int main() {
+    auto wall_start = std::chrono::steady_clock::now();
+
+    ControllerFixture fixture;
+    CHECK(fixture.initialize());
+
+    climate::ClimateCall call;
+    call.mode = climate::CLIMATE_MODE_HEAT;
+    call.target_temperature = 21;
+    fixture.controller.control(call);
+
+    Room room;
+    const uint32_t WEEK = 7u * 24 * 3600 * 1000;
+    const uint32_t MODEL_STEP = 60000;
+    uint32_t next_model_step = 0;
+    double squared_error = 0;
+    uint32_t samples = 0;
+    float worst_error = 0;
+    uint32_t start = sim_clock.now;
+
+    while (sim_clock.now - start < WEEK) {
+        if ((int32_t)(sim_clock.now - next_model_step) >= 0) {
+            next_model_step += MODEL_STEP;
+            uint32_t day = (sim_clock.now - start) / (24 * 3600 * 1000);
+            room.outdoor = 5 + 5 * std::sin((sim_clock.now - start) * 2 * M_PI / (24 * 3600 * 1000.0)) - day;
+            drive_room(fixture, room, MODEL_STEP / 1000.0);
+
+            if (sim_clock.now - start > 24 * 3600 * 1000) {
+                float error = room.temperature - 21;
+                squared_error += error * error;
+                samples++;
+                worst_error = std::max(worst_error, std::fabs(error));
+            }
+        }
+        fixture.step(20);
+    }
+
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+    double rms = std::sqrt(squared_error / samples);
+    std::printf("7 days simulated in %.1f s: rms error %.2f °C, worst %.2f °C, %u frames sent, %u register writes\n",
+                wall, rms, worst_error, fixture.uart.tx_frames, fixture.idu.writes);
+
+    CHECK(fixture.controller.is_initialized());
+    CHECK(rms < 0.3);
+    CHECK(worst_error < 0.6);
+    CHECK(fixture.controller.get_sensors()[11]->get_state() == 0 ||
+          std::isnan(fixture.controller.get_sensors()[11]->get_state()));  // no RX resyncs
+    return finish("test_week_simulation");
+}
@@ -0,0 +1,80 @@
+// Register writes are tracked until the IDU echoes them, retried when the echo is lost, and never left pending
+// when their frame did not make it onto the wire.
+#include "controller_fixture.h"
+
+using namespace toshiba_test;
+
+namespace {
+
+uint32_t writes_of(const ControllerFixture& fixture, uint32_t before) {
+    return fixture.idu.writes - before;
+}
+
+void lost_echo_is_retried() {
+    ControllerFixture fixture;
+    CHECK(fixture.initialize());
+    fixture.run_for(2000);
+
+    fixture.idu.drop_write_echoes = 1;
+    uint32_t writes = fixture.idu.writes;
+    fixture.controller.set_ionizer_switch(true);
+    fixture.run_for(5000);
+    CHECK_EQ(writes_of(fixture, writes), 2u);
+    CHECK_EQ(fixture.idu.registers[ToshibaCommand::IONIZER], ToshibaIonizer::IONIZER_ON);
+    CHECK(fixture.controller.get_switches()[1]->state);
+}
+
+void unconfirmed_write_rolls_back() {
+    ControllerFixture fixture;
+    CHECK(fixture.initialize());
+    fixture.run_for(2000);
+
+    // the IDU ignores the write entirely, so the optimistic state has to go
+    fixture.idu.drop_write_echoes = 255;
+    uint8_t mode_before = fixture.idu.registers[ToshibaCommand::MODE];
+    fixture.uart.set_sink(nullptr);
+    climate::ClimateCall call;
+    call.mode = climate::CLIMATE_MODE_COOL;
+    fixture.controller.control(call);
+    fixture.run_for(500);
+    CHECK_EQ(fixture.controller.mode, climate::CLIMATE_MODE_COOL);
+
+    fixture.uart.set_sink(&fixture.idu);
+    fixture.idu.registers[ToshibaCommand::MODE] = mode_before;
+    fixture.idu.drop_write_echoes = 0;
+    fixture.run_for(20000);
+    // the write is eventually delivered by a retry or rolled back, either way HA matches the IDU
+    bool delivered = fixture.idu.registers[ToshibaCommand::MODE] == ToshibaMode::MODE_COOL;
+    CHECK_EQ(fixture.controller.mode, delivered ? climate::CLIMATE_MODE_COOL : climate::CLIMATE_MODE_HEAT);
+}
+
+// a snapshot taken while cooling is restored on a unit that must not cool: the FAN_ONLY write queued by the
+// replayed handler is discarded with the pre-handshake queue and must not block the correction after the handshake
+void snapshot_replay_does_not_leave_writes_pending() {
+    ESPPreferences::erase_all();
+    {
+        ControllerFixture fixture;
+        fixture.idu.registers[ToshibaCommand::MODE] = ToshibaMode::MODE_COOL;
+        CHECK(fixture.initialize());
+        CHECK_EQ(fixture.controller.mode, climate::CLIMATE_MODE_COOL);
+        fixture.run_for(SNAPSHOT_MIN_SAVE_INTERVAL + 60000, 100);
+        CHECK(ESPPreferences::save_count() > 0);
+    }
+
+    ControllerFixture fixture;
+    fixture.idu.registers[ToshibaCommand::MODE] = ToshibaMode::MODE_COOL;
+    fixture.controller.config_settings().disable_cooling_modes = true;
+    CHECK(fixture.initialize());
+    fixture.run_for(10000);
+    CHECK_EQ(fixture.idu.registers[ToshibaCommand::MODE], ToshibaMode::MODE_FAN_ONLY);
+    CHECK_EQ(fixture.controller.mode, climate::CLIMATE_MODE_FAN_ONLY);
+}
+
+}  // namespace
+
+int main() {
+    lost_echo_is_retried();
+    unconfirmed_write_rolls_back();
+    snapshot_replay_does_not_leave_writes_pending();
+    return finish("test_write_confirmation");
+}